@@ -22,27 +22,152 @@
 * SECTION: newfs_util.c
 *******************************************************************************/
 char* 			   newfs_get_fname(const char* path);
-int 			   newfs_calc_lvl(const char * path);
+const char* 		   newfs_path_next(const char* path, int* len);
 int 			   newfs_driver_read(int offset, uint8_t *out_content, int size);
 int 			   newfs_driver_write(int offset, uint8_t *in_content, int size);
 
 int 			   newfs_mount(struct custom_options options);
 int 			   newfs_umount();
+int 			   newfs_checkpoint();
 
+struct newfs_dentry* new_dentry(const char* fname, NEWFS_FILE_TYPE ftype);
+void 			   newfs_free_dentry(struct newfs_dentry * dentry);
+void 			   newfs_free_names(struct newfs_inode * inode);
+uint32_t 		   newfs_name_hash(const char* fname, int len);
+int 			   newfs_dhash_add(struct newfs_inode * inode, struct newfs_dentry * dentry);
+struct newfs_dentry* newfs_dhash_find(struct newfs_inode * inode, const char* fname, int len);
 int 			   newfs_alloc_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry);
+int 			   newfs_drop_dentry(struct newfs_inode * inode, struct newfs_dentry * dentry);
 struct newfs_inode*  newfs_alloc_inode(struct newfs_dentry * dentry);
+void 			   newfs_free_inode(struct newfs_inode * inode);
+int 			   newfs_alloc_data();
+void 			   newfs_free_data(int dno);
+int 			   newfs_map_persist(boolean is_inode, int bit);
+int 			   newfs_bmap(struct newfs_inode * inode, int blk, boolean create);
+int 			   newfs_bunshare(struct newfs_inode * inode, int blk, boolean is_new);
 int 			   newfs_sync_inode(struct newfs_inode * inode);
+int 			   newfs_fsync_inode(struct newfs_inode * inode, boolean datasync);
 struct newfs_inode*  newfs_read_inode(struct newfs_dentry * dentry, int ino);
+void 			   newfs_inode_atime(struct newfs_inode * inode);
+void 			   newfs_inode_mtime(struct newfs_inode * inode);
+int 			   newfs_inode_decode(const uint8_t* itab, int ino, struct newfs_inode_d2* inode_d);
+void 			   newfs_inode_encode(uint8_t* itab, int ino, struct newfs_inode_d2* inode_d);
 struct newfs_dentry* newfs_get_dentry(struct newfs_inode * inode, int dir);
 
 struct newfs_dentry* newfs_lookup(const char * path, boolean * is_find, boolean* is_root);
 /******************************************************************************
+* SECTION: newfs_cache.c
+*******************************************************************************/
+int 			   newfs_cache_init(int nbufs);
+void 			   newfs_cache_destroy();
+uint8_t* 		   newfs_bread(int dno, boolean is_new);
+void 			   newfs_bdirty(int dno);
+void 			   newfs_binval(int dno);
+int 			   newfs_bflush();
+int 			   newfs_bsync(int dno);
+void 			   newfs_bdirty_meta(int dno);
+int 			   newfs_bmeta_cnt();
+int 			   newfs_bmeta_collect(int* dnos, uint8_t** datas, int max);
+void 			   newfs_bmeta_commit();
+/******************************************************************************
+* SECTION: newfs_slab.c
+*******************************************************************************/
+void* 			   newfs_slab_alloc(struct newfs_slab * slab);
+void 			   newfs_slab_free(struct newfs_slab * slab, void* obj);
+void 			   newfs_slab_destroy(struct newfs_slab * slab);
+/******************************************************************************
+* SECTION: newfs_pcache.c
+*******************************************************************************/
+int 			   newfs_pcache_init();
+void 			   newfs_pcache_destroy();
+struct newfs_dentry* newfs_pcache_find(const char* path, int len, boolean* is_find);
+void 			   newfs_pcache_add(const char* path, int len, struct newfs_dentry * dentry, boolean is_find);
+void 			   newfs_pcache_inval(struct newfs_inode * dir, struct newfs_dentry * dentry);
+void 			   newfs_pcache_flush();
+/******************************************************************************
+* SECTION: newfs_icache.c
+*******************************************************************************/
+struct newfs_inode*  newfs_icache_alloc();
+void 			   newfs_icache_drop(struct newfs_inode * inode);
+void 			   newfs_icache_add(struct newfs_inode * inode);
+struct newfs_inode*  newfs_icache_find(struct newfs_snap * snap, int ino);
+int 			   newfs_icache_sync();
+int 			   newfs_icache_dirty_cnt();
+void 			   newfs_icache_attach(struct newfs_inode * inode, struct newfs_dentry * dentry);
+void 			   newfs_icache_detach(struct newfs_dentry * dentry);
+void 			   newfs_icache_remove(struct newfs_inode * inode);
+void 			   newfs_icache_touch(struct newfs_inode * inode);
+void 			   newfs_icache_shrink();
+void 			   newfs_icache_destroy();
+void 			   newfs_iget(struct newfs_inode * inode);
+void 			   newfs_iput(struct newfs_inode * inode);
+void 			   newfs_inode_dirty(struct newfs_inode * inode);
+void 			   newfs_inode_dirty_time(struct newfs_inode * inode);
+void 			   newfs_inode_dirty_blocks(struct newfs_inode * inode);
+void 			   newfs_inode_clean(struct newfs_inode * inode);
+/******************************************************************************
+* SECTION: newfs_frag.c
+*******************************************************************************/
+int 			   newfs_frag_init(int head);
+int 			   newfs_frag_sync();
+void 			   newfs_frag_destroy();
+int 			   newfs_frag_alloc(int len, int* ofs);
+void 			   newfs_frag_free(int dno, int ofs, int len);
+int 			   newfs_frag_pack(struct newfs_inode * inode);
+int 			   newfs_frag_unpack(struct newfs_inode * inode);
+/******************************************************************************
+* SECTION: newfs_zip.c
+*******************************************************************************/
+int 			   newfs_lz_compress(const uint8_t* src, int n, uint8_t* dst, int cap);
+int 			   newfs_lz_decompress(const uint8_t* src, int clen, uint8_t* dst, int n);
+int 			   newfs_zip_init();
+void 			   newfs_zip_destroy();
+void 			   newfs_zip_forget(struct newfs_inode * inode);
+uint8_t* 		   newfs_zip_load(struct newfs_inode * inode);
+int 			   newfs_zip_pack(struct newfs_inode * inode);
+int 			   newfs_zip_unpack(struct newfs_inode * inode);
+/******************************************************************************
+* SECTION: newfs_dedup.c
+*******************************************************************************/
+int 			   newfs_dedup_init(boolean is_enable, boolean is_shared);
+void 			   newfs_dedup_destroy();
+void 			   newfs_dedup_hash(const uint8_t* data, uint64_t h[2]);
+int 			   newfs_dedup_find(const uint64_t h[2], const uint8_t* data);
+void 			   newfs_dedup_add(const uint64_t h[2], int dno);
+void 			   newfs_dedup_ref(int dno);
+boolean 		   newfs_dedup_shared(int dno);
+boolean 		   newfs_dedup_unref(int dno);
+/******************************************************************************
+* SECTION: newfs_journal.c
+*******************************************************************************/
+int 			   newfs_journal_replay(struct newfs_super_d* newfs_super_d);
+int 			   newfs_journal_init(int nbufs, struct newfs_super_d* newfs_super_d);
+void 			   newfs_journal_destroy();
+int 			   newfs_journal_commit();
+int 			   newfs_journal_checkpoint();
+void 			   newfs_journal_tick();
+void 			   newfs_journal_revoke(int dno);
+/******************************************************************************
+* SECTION: newfs_snap.c
+*******************************************************************************/
+int 			   newfs_snap_init(struct newfs_super_d* newfs_super_d, struct newfs_dentry* root_dentry);
+int 			   newfs_snap_sync(struct newfs_super_d* newfs_super_d);
+void 			   newfs_snap_super(struct newfs_super_d* newfs_super_d);
+int 			   newfs_snap_imap_reserve();
+int 			   newfs_snap_imap_dno();
+int 			   newfs_snap_imap_persist(int blk);
+void 			   newfs_snap_destroy();
+int 			   newfs_snap_create(const char* name);
+boolean 		   newfs_snap_shared(int dno);
+int 			   newfs_snap_itab_cow(int ino);
+/******************************************************************************
 * SECTION: newfs.c
 *******************************************************************************/
 void* 			   newfs_init(struct fuse_conn_info *);
 void  			   newfs_destroy(void *);
 int   			   newfs_mkdir(const char *, mode_t);
 int   			   newfs_getattr(const char *, struct stat *);
+int   			   newfs_statfs(const char *, struct statvfs *);
 int   			   newfs_readdir(const char *, void *, fuse_fill_dir_t, off_t,
 						                struct fuse_file_info *);
 int   			   newfs_mknod(const char *, mode_t, dev_t);
@@ -52,6 +177,7 @@ int   			   newfs_read(const char *, char *, size_t, off_t,
 					                 struct fuse_file_info *);
 int   			   newfs_access(const char *, int);
 int   			   newfs_unlink(const char *);
+int   			   newfs_link(const char *, const char *);
 int   			   newfs_rmdir(const char *);
 int   			   newfs_rename(const char *, const char *);
 int   			   newfs_utimens(const char *, const struct timespec tv[2]);
@@ -59,4 +185,8 @@ int   			   newfs_truncate(const char *, off_t);
 			
 int   			   newfs_open(const char *, struct fuse_file_info *);
 int   			   newfs_opendir(const char *, struct fuse_file_info *);
+int   			   newfs_releasedir(const char *, struct fuse_file_info *);
+int   			   newfs_fsync(const char *, int, struct fuse_file_info *);
+int   			   newfs_flush(const char *, struct fuse_file_info *);
+int   			   newfs_release(const char *, struct fuse_file_info *);
 #endif  /* _newfs_H_ */
\ No newline at end of file
@@ -35,24 +35,75 @@ typedef enum newfs_file_type {
 #define NEWFS_ERROR_UNSUPPORTED   ENXIO
 #define NEWFS_ERROR_IO            EIO     /* Error Input/Output */
 #define NEWFS_ERROR_INVAL         EINVAL  /* Invalid Args */
+#define NEWFS_ERROR_FBIG          EFBIG   /* 超出文件最大大小 */
+#define NEWFS_ERROR_ROFS          EROFS   /* 快照只读 */
+#define NEWFS_ERROR_NAMETOOLONG   ENAMETOOLONG
+#define NEWFS_ERROR_PERM          EPERM   /* 目录不能硬链接 */
+#define NEWFS_ERROR_MLINK         EMLINK
 
-#define NEWFS_MAX_FILE_NAME       128
+#define NEWFS_MAX_FILE_NAME       256       /* 含结尾'\0'，文件名最长255字节 */
 #define NEWFS_INODE_PER_FILE      1
 #define NEWFS_DATA_PER_FILE       4
 #define NEWFS_DEFAULT_PERM        0777
+#define NEWFS_LINK_MAX            65000     /* 普通文件的最大硬链接数 */
+#define NEWFS_NULL_BLK            -1        /* 未分配的数据块指针 */
 
 #define NEWFS_IOC_MAGIC           'S'
 #define NEWFS_IOC_SEEK            _IO(NEWFS_IOC_MAGIC, 0)
 
 #define NEWFS_FLAG_BUF_DIRTY      0x1
 #define NEWFS_FLAG_BUF_OCCUPY     0x2 
+#define NEWFS_FLAG_BUF_META       0x4           /* 未提交到日志的元数据块，不能原地写回 */
+#define NEWFS_FLAG_INODE_DIRTY    0x1           /* 内存inode与磁盘不一致，同步前不能淘汰 */
+#define NEWFS_FLAG_INODE_LAZY     0x2           /* 只有lazytime下的atime未写回，淘汰前顺带写回 */
+#define NEWFS_FLAG_INODE_BLOCKS   0x4           /* 大小或块指针已变，fdatasync也须写回inode */
  
 #define NEWFS_SUPER_BLKS          1
 #define NEWFS_MAP_INODE_BLKS      1
 #define NEWFS_MAP_DATA_BLKS       1
 
-#define NEWFS_INODE_BLKS          256
-#define NEWFS_DATA_BLKS           3837
+#define NEWFS_DEFAULT_BLK_SZ      1024      /* 格式化时未指定--blksz时的块大小 */
+#define NEWFS_MIN_BLK_SZ          1024
+#define NEWFS_MAX_BLK_SZ          65536
+#define NEWFS_INODE_RATIO         64        /* 格式化时预分配的inode区占磁盘块数的1/64，其余inode表块按需分配 */
+
+#define NEWFS_CACHE_SZ            (256 * 1024)  /* 块缓存容量(字节) */
+#define NEWFS_CACHE_MIN_BLKS      8
+#define NEWFS_CACHELINE           64            /* 缓存块按缓存行对齐，v2 inode记录不跨行 */
+
+#define NEWFS_FRAG_MAGIC          0x47415246    /* 碎片块头部魔数 */
+#define NEWFS_FRAG_UNITS          32            /* 每个碎片块的单元数，单元0为头部 */
+
+#define NEWFS_DEDUP_ENTRIES       4096          /* 指纹索引容量 */
+#define NEWFS_DEDUP_WAYS          4
+
+#define NEWFS_ATIME_RELATIME      0             /* 默认: atime不晚于mtime/ctime或已过一天时才更新 */
+#define NEWFS_ATIME_NOATIME       1             /* 读不更新atime */
+#define NEWFS_ATIME_LAZYTIME      2             /* 只更新内存inode，随其他修改或检查点写回 */
+#define NEWFS_ATIME_STRICT        3             /* 每次读都更新并写回 */
+#define NEWFS_RELATIME_SEC        (24 * 60 * 60)
+
+#define NEWFS_FEATURE_DEDUP       0x1           /* 磁盘上可能存在共享数据块 */
+#define NEWFS_FEATURE_INODE_V2    0x2           /* inode记录为256字节的newfs_inode_d2 */
+#define NEWFS_FEATURE_JOURNAL     0x4           /* 布局中有元数据日志区 */
+
+#define NEWFS_JOURNAL_MAGIC       0x4c4e524a    /* 日志区头部魔数 */
+#define NEWFS_JDESC_MAGIC         0x4353454a    /* 事务描述块魔数 */
+#define NEWFS_JOURNAL_RATIO       32            /* 格式化时日志区占磁盘块数的1/32 */
+#define NEWFS_JOURNAL_MIN_BLKS    16            /* 不足此数时不建日志区 */
+#define NEWFS_JOURNAL_INTERVAL    5             /* 组提交的最长间隔(秒) */
+
+#define NEWFS_MAX_SNAPS           16
+#define NEWFS_SNAP_NAME           32
+#define NEWFS_SNAP_DIR            ".snapshots"  /* 根目录下隐藏的快照目录 */
+
+#define NEWFS_DHASH_MIN           8             /* 目录项哈希表的初始桶数，须为2的幂 */
+#define NEWFS_NAME_CHUNK_SZ       4096          /* 目录名字区每段的大小 */
+#define NEWFS_SLAB_CHUNK_SZ       16384         /* slab每次向系统申请的大小 */
+#define NEWFS_IO_STACK_SZ         1024          /* 不超过此大小的非对齐驱动读写使用栈上缓冲 */
+#define NEWFS_PCACHE_SZ           1024          /* 路径缓存的槽数，须为2的幂 */
+#define NEWFS_ICACHE_SZ           1024          /* 内存inode数的上限，超过时淘汰干净的叶子 */
+#define NEWFS_ICACHE_HASH         2048          /* (快照, ino)到内存inode的哈希桶数，须为2的幂 */
 
 /******************************************************************************
 * SECTION: Macro Function
@@ -63,46 +114,95 @@ typedef enum newfs_file_type {
 #define NEWFS_DISK_SZ()                   (newfs_super.sz_disk)
 #define NEWFS_DRIVER()                    (newfs_super.fd)
 #define NEWFS_BLKS_SZ(blks)               ((blks) * NEWFS_BLK_SZ())
-#define NEWFS_MAX_DENTRY_BLK()            (NEWFS_BLK_SZ() / sizeof(struct newfs_dentry))
+/* 变长目录项: 头部加名字，按4字节对齐；rec_len为0表示64KiB(整块只有一项) */
+#define NEWFS_DIRENT_LEN(name_len)        NEWFS_ROUND_UP(sizeof(struct newfs_dentry_d) + (name_len), 4)
+#define NEWFS_REC_LEN(pdentry_d)          ((pdentry_d)->rec_len == 0 ? NEWFS_MAX_BLK_SZ : (pdentry_d)->rec_len)
+#define NEWFS_INODE_SZ()                  (newfs_super.sz_inode)
+#define NEWFS_INODE_PER_BLK()             (NEWFS_BLK_SZ() / NEWFS_INODE_SZ())
+#define NEWFS_FRAG_SZ()                   (NEWFS_BLK_SZ() / NEWFS_FRAG_UNITS)
+#define NEWFS_JDESC_MAX()                 ((NEWFS_BLK_SZ() - (int)sizeof(struct newfs_jdesc_d)) / (int)sizeof(int))
 
 #define NEWFS_ROUND_DOWN(value, round)    ((value) % (round) == 0 ? (value) : ((value) / (round)) * (round))
 #define NEWFS_ROUND_UP(value, round)      ((value) % (round) == 0 ? (value) : ((value) / (round) + 1) * (round))
 
-#define NEWFS_ASSIGN_FNAME(pnewfs_dentry, _fname)   memcpy(pnewfs_dentry->fname, _fname, strlen(_fname))
-
-#define NEWFS_INO_OFS(ino)                (newfs_super.inode_offset + NEWFS_BLKS_SZ(ino))
+/* inode表按块经imap映射到磁盘块号，快照之后被改写的inode表块会写时复制到数据区。
+ * inode表块经块缓存整块读写，缓存键是相对数据区的块号，原inode区中的块为负数 */
+#define NEWFS_ITAB_DNO(imap, ino)         ((imap)[(ino) / NEWFS_INODE_PER_BLK()] \
+                                           - newfs_super.data_offset / NEWFS_BLK_SZ())
+#define NEWFS_ITAB_REC(ino)               (((ino) % NEWFS_INODE_PER_BLK()) * NEWFS_INODE_SZ())
 #define NEWFS_DATA_OFS(dno)               (newfs_super.data_offset + NEWFS_BLKS_SZ(dno))
 
 #define NEWFS_IS_DIR(pinode)              (pinode->dentry->ftype == NEWFS_DIR)
 #define NEWFS_IS_REG(pinode)              (pinode->dentry->ftype == NEWFS_FILE)
+#define NEWFS_IS_ZIP(pinode)              (pinode->zlen > 0)
+
+#define NEWFS_SLAB_INIT(name, type)       { name, sizeof(type), NULL, NULL, 0, 0 }
 
 struct newfs_dentry;
 struct newfs_inode;
 struct newfs_super;
+struct newfs_snap;
 
 
 struct custom_options {
 	const char*        device;
+	int                blksz;               /* 格式化时使用的块大小，已格式化的磁盘以超级块为准 */
+	int                tailpack;            /* 同步时把小文件尾部打包进共享碎片块 */
+	int                compress;            /* 同步时压缩普通文件 */
+	int                dedup;               /* 写整块时去重 */
+	int                atime;               /* NEWFS_ATIME_*，读操作何时更新atime */
 };
 
 struct newfs_inode {
     int           ino;                                  /* 在inode位图中的下标 */
     int                size;                            /* 文件已占用空间 */
-    int                link;
+    int                link;                            /* 硬链接数，降为0时释放 */
     int                block_pointer[NEWFS_DATA_PER_FILE]; //数据块块号
     int                dir_cnt;                         //目录项下几个子文件
-    struct newfs_dentry* dentry;                        /* 指向该inode的dentry */
+    int                frag_blk;                        /* 尾部所在碎片块，NEWFS_NULL_BLK表示未打包 */
+    int                frag_ofs;                        /* 尾部在碎片块内的偏移 */
+    int                frag_len;                        /* 尾部长度 */
+    int                zlen;                            /* 压缩后长度，0表示未压缩 */
+    uint32_t           mode;                            /* 类型和权限位 */
+    uint32_t           uid;
+    uint32_t           gid;
+    struct timespec    atime;
+    struct timespec    mtime;
+    struct timespec    ctime;
+    struct newfs_dentry* dentry;                        /* 指向该inode的第一个dentry，其余经alias串起 */
     struct newfs_dentry* dentrys;                       /* 目录项链表头 */
-    uint8_t*           data[NEWFS_DATA_PER_FILE];      // 指向数据块
+    struct newfs_dentry** dhash;                        /* 目录项哈希表，按名字哈希分桶 */
+    int                dhash_sz;                        /* 桶数，目录项数超过桶数时翻倍 */
+    struct newfs_dentry* dirty_dents;                   /* 磁盘目录项待补写的子目录项 */
+    struct newfs_name_chunk* names;                     /* 子目录项的名字区，随目录释放 */
+    int                names_dead;                      /* 名字区中已删除目录项的名字占用的字节数 */
+    uint32_t           gen;                             /* 目录项被删除时加一，使路径缓存失效 */
+    struct newfs_dir_cursor* cursors;                   /* 在该目录上打开的readdir游标 */
+    int                ref;                             /* 打开句柄等跨调用的引用，非0时不淘汰 */
+    int                nchild;                          /* 已载入inode的子目录项数，非0时不淘汰 */
+    flag16             flags;                           /* NEWFS_FLAG_INODE_* */
+    struct newfs_inode* lru_prev;
+    struct newfs_inode* lru_next;
+    struct newfs_inode* hash_next;                      /* inode缓存中同一哈希桶的下一项 */
+    struct newfs_inode* dirty_prev;                     /* 脏inode链表，按首次变脏的先后排列 */
+    struct newfs_inode* dirty_next;
     NEWFS_FILE_TYPE          ftype;
 };
 
 struct newfs_dentry {
-    int ino;
-    char               fname[NEWFS_MAX_FILE_NAME];
+    const char*          fname;                         /* 指向父目录名字区中以'\0'结尾的名字 */
     struct newfs_dentry* parent;                        /* 父亲Inode的dentry */
     struct newfs_dentry* brother;                       /* 兄弟 */
     struct newfs_inode*  inode;                         /* 指向inode */
+    struct newfs_snap*   snap;                          /* 所属快照，NULL表示活动文件系统 */
+    struct newfs_dentry* hash_next;                     /* 同一哈希桶中的下一项 */
+    struct newfs_dentry* dirty_next;                    /* 父目录dirty_dents链表中的下一项 */
+    struct newfs_dentry* alias;                         /* 指向同一内存inode的下一个dentry(硬链接) */
+    int                  ino;
+    uint32_t             hash;                          /* 名字哈希 */
+    uint16_t             dofs;                          /* 磁盘目录项在块内的偏移 */
+    uint8_t              dblk;                          /* 磁盘目录项所在的目录内逻辑块号 */
+    uint8_t              name_len;
     NEWFS_FILE_TYPE      ftype;
 };
 
@@ -114,33 +214,91 @@ struct newfs_super {
     int                sz_disk;        //虚拟磁盘sz
     int                sz_usage;
     int                sz_blks;         //磁盘块sz
+    int                sz_inode;        // 磁盘inode记录大小，由NEWFS_FEATURE_INODE_V2决定
     //索引节点
     int                max_ino;         //索引节点最大数量
     uint8_t*           map_inode;       
     int                map_inode_blks; //索引位图块数
     int                map_inode_offset;  //位图偏移
     int                inode_offset;    // 索引节点的起始地址
+    int*               imap;            // inode表块 -> 磁盘块号，NEWFS_NULL_BLK表示尚未分配
+    int                inode_blks;      // inode表块数(imap长度)，由max_ino决定
+    int                inode_fixed_blks;// inode区中预分配的inode表块数
     //数据块
     uint8_t*           map_data;        
     int                max_data;        //数据块最大数量
     int                data_offset;     //数据起始地址
     int                map_data_offset; // data位图的起始地址
     int                map_data_blks;   // data位图所占的块数
-    
+    boolean            is_tailpack;     // 同步时打包文件尾部
+    boolean            is_compress;     // 同步时压缩普通文件
+    boolean            is_dedup;        // 写整块时去重
+    int                atime_policy;    // NEWFS_ATIME_*
+    uint32_t           features;        // NEWFS_FEATURE_*
+    boolean            is_journal;      // 元数据经日志提交
+    int                journal_offset;  // 日志区起始地址
+    int                journal_blks;    // 日志区块数
+
     boolean            is_mounted;
     struct newfs_dentry* root_dentry;
+    struct newfs_dentry* snap_dentry;   // 隐藏的/.snapshots
+};
+
+struct newfs_snap {
+    char               name[NEWFS_SNAP_NAME];
+    int                imap_dno;                        /* 冻结的inode表映射 */
+    int                map_dno;                         /* 冻结的数据位图 */
+    int*               imap;
+    uint8_t*           map;                             /* 仅最新快照载入，用于判断共享 */
+    struct newfs_dentry* dentry;                        /* 快照根目录 */
+};
+struct newfs_buf {
+    int                dno;                             /* 缓存的数据块号 */
+    flag16             flags;                           /* NEWFS_FLAG_BUF_* */
+    uint8_t*           data;
+    struct newfs_buf*  hash_next;
+    struct newfs_buf*  lru_prev;
+    struct newfs_buf*  lru_next;
+    struct newfs_buf*  dirty_prev;                      /* 脏块链表，按首次变脏的先后排列 */
+    struct newfs_buf*  dirty_next;
+};
+
+struct newfs_name_chunk {
+    struct newfs_name_chunk* next;
+    int                used;
+    int                cap;
+    char               data[];
+};
+
+struct newfs_slab {
+    const char*        name;
+    size_t             obj_sz;
+    void*              free;                            /* 空闲对象链表，链接指针存放在对象首部 */
+    void*              chunks;                          /* 已申请的大块链表 */
+    int                live;                            /* 已分配未释放的对象数 */
+    int                nchunks;
+};
+
+struct newfs_path_ent {
+    uint32_t           hash;                            /* 整条路径的哈希 */
+    uint32_t           gen;                             /* 缓存时的全局代数 */
+    uint32_t           dir_gen;                         /* 缓存时dir的代数 */
+    int                dir_cnt;                         /* 缓存时dir的目录项数，否定项用 */
+    boolean            is_find;                         /* FALSE为否定项: 路径不存在，查找止于dir */
+    int                len;
+    int                cap;                             /* path缓冲区大小 */
+    char*              path;
+    struct newfs_dentry* dir;                           /* 肯定项为父目录，否定项为未找到下一分量的目录 */
+    struct newfs_dentry* dentry;                        /* NULL表示空槽 */
+};
+
+struct newfs_dir_cursor {
+    struct newfs_dentry* dir;                           /* opendir时解析出的目录 */
+    struct newfs_dentry* next;                          /* 下一个要填充的目录项 */
+    off_t              pos;                             /* 内核从next继续时传入的offset */
+    int                left;                            /* 从next到链表尾的目录项数 */
+    struct newfs_dir_cursor* link;                      /* 同一目录上的下一个游标 */
 };
-static inline struct newfs_dentry* new_dentry(char * fname, NEWFS_FILE_TYPE ftype) {
-    struct newfs_dentry * dentry = (struct newfs_dentry *)malloc(sizeof(struct newfs_dentry));
-    memset(dentry, 0, sizeof(struct newfs_dentry));
-    NEWFS_ASSIGN_FNAME(dentry, fname);
-    dentry->ftype   = ftype;
-    dentry->ino     = -1;
-    dentry->inode   = NULL;
-    dentry->parent  = NULL;
-    dentry->brother = NULL;  
-    return dentry;                                          
-}
 
 /******************************************************************************
 * SECTION: FS Specific Structure - Disk structure
@@ -158,9 +316,20 @@ struct newfs_super_d
 
     int                data_offset;         // 数据块起始地址
     int                inode_offset;        // 索引节点起始地址
+
+    int                sz_blks;             // 格式化时选定的块大小，0为引入此字段前的旧格式，不再支持挂载
+    int                max_ino;             // 索引节点数量
+    int                max_data;            // 数据块数量
+    int                frag_head;           // 碎片块链表头
+    uint32_t           features;            // NEWFS_FEATURE_*
+    int                snap_cnt;            // 快照数量
+    int                snap_blk;            // 快照表所在数据块
+    int                imap_dno;            // 活动inode表映射所在数据块，NEWFS_NULL_BLK表示恒等映射
+    int                journal_offset;      // 日志区起始地址，NEWFS_FEATURE_JOURNAL时有效
+    int                journal_blks;        // 日志区块数
 };
 
-//结构体大小为36字节
+//结构体大小为52字节
 struct newfs_inode_d
 {
     uint32_t           ino;                           /* 在inode位图中的下标 */
@@ -169,13 +338,81 @@ struct newfs_inode_d
     int                block_pointer[NEWFS_DATA_PER_FILE];// 数据块指针 
     uint32_t           dir_cnt;
     NEWFS_FILE_TYPE      ftype;
+    int                frag_blk;                      /* 尾部碎片(块号, 偏移, 长度) */
+    int                frag_ofs;
+    int                frag_len;
+    int                zlen;                          /* 压缩后长度，0表示未压缩 */
 };  
 
+/* v2格式，结构体大小为256字节，按缓存行对齐存放，每块整数个记录 */
+struct newfs_inode_d2
+{
+    uint32_t           ino;
+    uint32_t           size;
+    int                link;                          /* 硬链接数 */
+    uint32_t           dir_cnt;
+    NEWFS_FILE_TYPE    ftype;
+    uint32_t           mode;                          /* 类型和权限位 */
+    uint32_t           uid;
+    uint32_t           gid;
+    int64_t            atime_sec;
+    int64_t            mtime_sec;
+    int64_t            ctime_sec;
+    uint32_t           atime_nsec;
+    uint32_t           mtime_nsec;
+    uint32_t           ctime_nsec;
+    uint32_t           flags;                         /* 保留，目前为0 */
+    int                block_pointer[NEWFS_DATA_PER_FILE];
+    int                frag_blk;
+    int                frag_ofs;
+    int                frag_len;
+    int                zlen;
+    uint8_t            spare[148];                    /* 预留给extent或内联数据，目前为0 */
+    uint32_t           checksum;                      /* 此前所有字节的FNV-1a */
+};
+
+struct newfs_frag_d
+{
+    uint32_t           magic;                         /* NEWFS_FRAG_MAGIC */
+    uint32_t           map;                           /* 单元占用位图，第0位为头部 */
+    int                next;                          /* 下一个碎片块 */
+};
+
+/* 日志区第0块，其余各块循环存放事务 */
+struct newfs_journal_d
+{
+    uint32_t           magic;                         /* NEWFS_JOURNAL_MAGIC */
+    uint32_t           seq;                           /* tail处事务的序号 */
+    int                tail;                          /* 最早一个未检查点的事务在日志区中的块号 */
+};
+
+/* 事务描述块，其后紧跟nr个日志块，整个事务一次顺序写入 */
+struct newfs_jdesc_d
+{
+    uint32_t           magic;                         /* NEWFS_JDESC_MAGIC */
+    uint32_t           seq;
+    int                nr;                            /* 日志块数 */
+    int                nrevoke;                       /* 撤销的块数 */
+    uint32_t           checksum;                      /* 描述块(此项为0)与日志块的FNV-1a */
+    int                target[];                      /* nr个日志块的磁盘块号，再接nrevoke个撤销的块号 */
+};
+
+struct newfs_snap_d
+{
+    char               name[NEWFS_SNAP_NAME];
+    int                imap_dno;
+    int                map_dno;
+};
+
+/* ext2式变长目录项，在目录块内首尾相接，块内最后一项的rec_len延伸到块尾 */
 struct newfs_dentry_d
 {
-    char               fname[NEWFS_MAX_FILE_NAME];
-    NEWFS_FILE_TYPE      ftype;
     uint32_t           ino;                           /* 指向的ino号 */
+    uint32_t           hash;                          /* 名字哈希，载入目录时无需重新计算 */
+    uint16_t           rec_len;                       /* 到下一项的距离 */
+    uint8_t            name_len;                      /* 0表示空闲项 */
+    uint8_t            ftype;
+    char               name[];                        /* 不以'\0'结尾 */
 };  
 
 #endif /* _TYPES_H_ */
\ No newline at end of file
@@ -1,41 +1,120 @@
 #define _XOPEN_SOURCE 700
 
 #include "newfs.h"
+#include <pthread.h>
 
 /******************************************************************************
 * SECTION: 宏定义
 *******************************************************************************/
 #define OPTION(t, p)        { t, offsetof(struct custom_options, p), 1 }
+#define OPTION_VAL(t, p, v) { t, offsetof(struct custom_options, p), v }
+#define NEWFS_NEGATIVE_TIMEOUT  "-onegative_timeout=1"	/* 内核缓存不存在的路径1秒，可被命令行覆盖 */
 
 /******************************************************************************
 * SECTION: 全局变量
 *******************************************************************************/
 static const struct fuse_opt option_spec[] = {		/* 用于FUSE文件系统解析参数 */
 	OPTION("--device=%s", device),
+	OPTION("--blksz=%d", blksz),
+	OPTION("--tailpack", tailpack),
+	OPTION("--compress", compress),
+	OPTION("--dedup", dedup),
+	OPTION_VAL("--relatime", atime, NEWFS_ATIME_RELATIME),
+	OPTION_VAL("--noatime", atime, NEWFS_ATIME_NOATIME),
+	OPTION_VAL("--lazytime", atime, NEWFS_ATIME_LAZYTIME),
+	OPTION_VAL("--strictatime", atime, NEWFS_ATIME_STRICT),
 	FUSE_OPT_END
 };
 extern struct custom_options newfs_options;			 /* 全局选项 */
 extern struct newfs_super newfs_super; 
+static struct newfs_slab cursor_slab = NEWFS_SLAB_INIT("dir_cursor", struct newfs_dir_cursor);
+/******************************************************************************
+* SECTION: 回调互斥与后台提交
+* main强制FUSE单线程派发回调，但组提交原本只在newfs_lookup开始时检查，挂载后一直空闲就永远不会提交。
+* 启用日志时另起一个提交线程，每NEWFS_JOURNAL_INTERVAL秒醒来检查一次；
+* 它与回调经newfs_lock互斥，回调都经NEWFS_LOCKED生成的包装函数进入。
+*******************************************************************************/
+static pthread_mutex_t newfs_lock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  commit_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t       commit_thread;
+static boolean         commit_running;
+
+#define NEWFS_LOCKED(op, params, args)							\
+	static int newfs_locked_##op params {						\
+		int ret;												\
+		pthread_mutex_lock(&newfs_lock);						\
+		ret = newfs_##op args;									\
+		pthread_mutex_unlock(&newfs_lock);						\
+		return ret;												\
+	}
+
+NEWFS_LOCKED(mkdir, (const char* path, mode_t mode), (path, mode))
+NEWFS_LOCKED(getattr, (const char* path, struct stat* st), (path, st))
+NEWFS_LOCKED(statfs, (const char* path, struct statvfs* st), (path, st))
+NEWFS_LOCKED(readdir, (const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
+					   struct fuse_file_info* fi), (path, buf, filler, offset, fi))
+NEWFS_LOCKED(mknod, (const char* path, mode_t mode, dev_t dev), (path, mode, dev))
+NEWFS_LOCKED(write, (const char* path, const char* buf, size_t size, off_t offset,
+					 struct fuse_file_info* fi), (path, buf, size, offset, fi))
+NEWFS_LOCKED(read, (const char* path, char* buf, size_t size, off_t offset,
+					struct fuse_file_info* fi), (path, buf, size, offset, fi))
+NEWFS_LOCKED(utimens, (const char* path, const struct timespec tv[2]), (path, tv))
+NEWFS_LOCKED(truncate, (const char* path, off_t offset), (path, offset))
+NEWFS_LOCKED(link, (const char* from, const char* to), (from, to))
+NEWFS_LOCKED(unlink, (const char* path), (path))
+NEWFS_LOCKED(opendir, (const char* path, struct fuse_file_info* fi), (path, fi))
+NEWFS_LOCKED(releasedir, (const char* path, struct fuse_file_info* fi), (path, fi))
+NEWFS_LOCKED(fsync, (const char* path, int datasync, struct fuse_file_info* fi), (path, datasync, fi))
+NEWFS_LOCKED(flush, (const char* path, struct fuse_file_info* fi), (path, fi))
+NEWFS_LOCKED(release, (const char* path, struct fuse_file_info* fi), (path, fi))
+
+/**
+ * @brief 提交线程: 持锁等待NEWFS_JOURNAL_INTERVAL秒，超时后按组提交的条件检查一次
+ *
+ * @param arg 未使用
+ * @return void*
+ */
+static void* newfs_commit_main(void* arg) {
+	struct timespec deadline;
+
+	pthread_mutex_lock(&newfs_lock);
+	while (commit_running) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += NEWFS_JOURNAL_INTERVAL;
+		if (pthread_cond_timedwait(&commit_cond, &newfs_lock, &deadline) == ETIMEDOUT && commit_running) {
+			newfs_journal_tick();
+		}
+	}
+	pthread_mutex_unlock(&newfs_lock);
+	return NULL;
+}
 /******************************************************************************
 * SECTION: FUSE操作定义
 *******************************************************************************/
 static struct fuse_operations operations = {
 	.init = newfs_init,						 /* mount文件系统 */		
 	.destroy = newfs_destroy,				 /* umount文件系统 */
-	.mkdir = newfs_mkdir,					 /* 建目录，mkdir */
-	.getattr = newfs_getattr,				 /* 获取文件属性，类似stat，必须完成 */
-	.readdir = newfs_readdir,				 /* 填充dentrys */
-	.mknod = newfs_mknod,					 /* 创建文件，touch相关 */
-	.write = NULL,								  	 /* 写入文件 */
-	.read = NULL,								  	 /* 读文件 */
-	.utimens = newfs_utimens,				 /* 修改时间，忽略，避免touch报错 */
-	.truncate = NULL,						  		 /* 改变文件大小 */
-	.unlink = NULL,							  		 /* 删除文件 */
+	.mkdir = newfs_locked_mkdir,			 /* 建目录，mkdir */
+	.getattr = newfs_locked_getattr,		 /* 获取文件属性，类似stat，必须完成 */
+	.statfs = newfs_locked_statfs,			 /* 空闲块和inode数，df */
+	.readdir = newfs_locked_readdir,		 /* 填充dentrys */
+	.mknod = newfs_locked_mknod,			 /* 创建文件，touch相关 */
+	.write = newfs_locked_write,			 /* 写入文件 */
+	.read = newfs_locked_read,				 /* 读文件 */
+	.utimens = newfs_locked_utimens,		 /* 修改atime/mtime，touch */
+	.truncate = newfs_locked_truncate,		 /* 改变文件大小 */
+	.link = newfs_locked_link,				 /* 硬链接，ln */
+	.unlink = newfs_locked_unlink,			 /* 删除文件 */
 	.rmdir	= NULL,							  		 /* 删除目录， rm -r */
 	.rename = NULL,							  		 /* 重命名，mv */
 
 	.open = NULL,							
-	.opendir = NULL,
+	.opendir = newfs_locked_opendir,		 /* 解析目录并建立readdir游标 */
+	.releasedir = newfs_locked_releasedir,	 /* 释放readdir游标 */
+	.fsync = newfs_locked_fsync,			 /* 只写回该文件，fsync/fdatasync */
+	.fsyncdir = newfs_locked_fsync,			 /* 目录同样写回其目录项块 */
+	.flush = newfs_locked_flush,			 /* close */
+	.release = newfs_locked_release,		 /* 最后一个句柄关闭 */
 	.access = NULL
 };
 /******************************************************************************
@@ -54,7 +133,13 @@ void* newfs_init(struct fuse_conn_info * conn_info) {
 		fuse_exit(fuse_get_context()->fuse);
 		return NULL;
 	}
-	
+	if (newfs_super.is_journal) {					/* 在FUSE转入后台之后才创建，线程不会丢在fork之前 */
+		commit_running = TRUE;
+		if (pthread_create(&commit_thread, NULL, newfs_commit_main, NULL) != 0) {
+			NEWFS_DBG("[%s] no commit thread, commits only on lookups\n", __func__);
+			commit_running = FALSE;
+		}
+	}
 	return NULL;
 }
 
@@ -66,11 +151,19 @@ void* newfs_init(struct fuse_conn_info * conn_info) {
  */
 void newfs_destroy(void* p) {
 	/* TODO: 在这里进行卸载 */
+	if (commit_running) {							/* 先停提交线程，卸载时不再持锁 */
+		pthread_mutex_lock(&newfs_lock);
+		commit_running = FALSE;
+		pthread_cond_signal(&commit_cond);
+		pthread_mutex_unlock(&newfs_lock);
+		pthread_join(commit_thread, NULL);
+	}
 	if (newfs_umount() != NEWFS_ERROR_NONE) {
 		NEWFS_DBG("[%s] unmount error\n", __func__);
 		fuse_exit(fuse_get_context()->fuse);
 		return;
 	}
+	newfs_slab_destroy(&cursor_slab);				/* 卸载时已没有打开的目录 */
 
 	return;
 }
@@ -84,12 +177,16 @@ void newfs_destroy(void* p) {
  */
 int newfs_mkdir(const char* path, mode_t mode) {
 	(void)mode;
+	int     ret;
 	boolean is_find, is_root;
 	char* fname;    
 	struct newfs_dentry* last_dentry = newfs_lookup(path, &is_find, &is_root);
 	struct newfs_dentry* dentry;
 	struct newfs_inode*  inode;
 	
+	if (last_dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
 	if (is_find) {
 		return -NEWFS_ERROR_EXISTS;
 	}
@@ -99,14 +196,55 @@ int newfs_mkdir(const char* path, mode_t mode) {
 	}
 
 	fname  = newfs_get_fname(path);
+	if (last_dentry == newfs_super.snap_dentry) {		/* mkdir /.snapshots/<name> 创建快照 */
+		return newfs_snap_create(fname);
+	}
+	if (last_dentry->snap != NULL) {
+		return -NEWFS_ERROR_ROFS;
+	}
+	if (strlen(fname) >= NEWFS_MAX_FILE_NAME) {
+		return -NEWFS_ERROR_NAMETOOLONG;
+	}
 	dentry = new_dentry(fname, NEWFS_DIR); 
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
 	dentry->parent = last_dentry;
+	ret    = newfs_alloc_dentry(last_dentry->inode, dentry);
+	if (ret < 0) {
+		newfs_free_dentry(dentry);
+		return ret;
+	}
 	inode  = newfs_alloc_inode(dentry);
-	newfs_alloc_dentry(last_dentry->inode, dentry);
+	if (inode == NULL) {							/* inode用尽，撤销目录项 */
+		newfs_drop_dentry(last_dentry->inode, dentry);
+		newfs_free_dentry(dentry);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	newfs_inode_mtime(last_dentry->inode);
 	
 	return 0;
 }
 
+/**
+ * @brief 文件实际占用的512B块数，碎片尾部按占用的单元计
+ * 
+ * @param inode 普通文件
+ * @return blkcnt_t 
+ */
+static blkcnt_t newfs_stat_blocks(struct newfs_inode* inode) {
+	int blk, bytes = 0;
+	for (blk = 0; blk < NEWFS_DATA_PER_FILE; blk++) {
+		if (inode->block_pointer[blk] != NEWFS_NULL_BLK) {
+			bytes += NEWFS_BLK_SZ();
+		}
+	}
+	if (inode->frag_blk != NEWFS_NULL_BLK) {
+		bytes += NEWFS_ROUND_UP(inode->frag_len, NEWFS_FRAG_SZ());
+	}
+	return NEWFS_ROUND_UP(bytes, 512) / 512;
+}
+
 /**
  * @brief 获取文件或目录的属性，该函数非常重要
  * 
@@ -119,24 +257,29 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
 	boolean	is_find, is_root;
 
 	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
 	if (is_find == FALSE) {
 		return -NEWFS_ERROR_NOTFOUND;
 	}
 
 	if (NEWFS_IS_DIR(dentry->inode)) {
 		newfs_stat->st_mode = NEWFS_DEFAULT_PERM | S_IFDIR;
-		newfs_stat->st_size = dentry->inode->dir_cnt * sizeof(struct newfs_dentry_d);
+		newfs_stat->st_size = dentry->inode->size;			/* 目录块总大小 */
 	}
 	else if (NEWFS_IS_REG(dentry->inode)) {
 		newfs_stat->st_mode = NEWFS_DEFAULT_PERM | S_IFREG;
 		newfs_stat->st_size = dentry->inode->size;
+		newfs_stat->st_blocks = newfs_stat_blocks(dentry->inode);	/* 与st_size之比即压缩/打包效果 */
 	}
 
-	newfs_stat->st_nlink   = 1;
+	newfs_stat->st_nlink   = NEWFS_IS_REG(dentry->inode) ? dentry->inode->link : 1;
 	newfs_stat->st_uid 	 = getuid();
 	newfs_stat->st_gid 	 = getgid();
-	newfs_stat->st_atime   = time(NULL);
-	newfs_stat->st_mtime   = time(NULL);
+	newfs_stat->st_atim    = dentry->inode->atime;
+	newfs_stat->st_mtim    = dentry->inode->mtime;
+	newfs_stat->st_ctim    = dentry->inode->ctime;
 	newfs_stat->st_blksize = NEWFS_BLK_SZ();
 
 	if (is_root) {
@@ -147,6 +290,45 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
 	return NEWFS_ERROR_NONE;
 }
 
+/**
+ * @brief 位图前max位中清零位的个数
+ * 
+ * @param map 位图
+ * @param max 有效位数
+ * @return fsblkcnt_t 
+ */
+static fsblkcnt_t newfs_map_free(const uint8_t* map, int max) {
+	fsblkcnt_t free_cnt = 0;
+	int        bit;
+	for (bit = 0; bit < max; bit++) {
+		if ((map[bit / UINT8_BITS] & (0x1 << (bit % UINT8_BITS))) == 0) {
+			free_cnt++;
+		}
+	}
+	return free_cnt;
+}
+
+/**
+ * @brief 获取文件系统的容量，块数只计DATA区，去重共享的块只占一块
+ * 
+ * @param path 可忽略
+ * @param newfs_statvfs 返回状态
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_statfs(const char* path, struct statvfs * newfs_statvfs) {
+	memset(newfs_statvfs, 0, sizeof(struct statvfs));
+	newfs_statvfs->f_bsize   = NEWFS_BLK_SZ();
+	newfs_statvfs->f_frsize  = NEWFS_BLK_SZ();
+	newfs_statvfs->f_blocks  = newfs_super.max_data;
+	newfs_statvfs->f_bfree   = newfs_map_free(newfs_super.map_data, newfs_super.max_data);
+	newfs_statvfs->f_bavail  = newfs_statvfs->f_bfree;
+	newfs_statvfs->f_files   = newfs_super.max_ino;
+	newfs_statvfs->f_ffree   = newfs_map_free(newfs_super.map_inode, newfs_super.max_ino);
+	newfs_statvfs->f_favail  = newfs_statvfs->f_ffree;
+	newfs_statvfs->f_namemax = NEWFS_MAX_FILE_NAME - 1;
+	return NEWFS_ERROR_NONE;
+}
+
 /**
  * @brief 遍历目录项，填充至buf，并交给FUSE输出
  * 
@@ -159,30 +341,47 @@ int newfs_getattr(const char* path, struct stat * newfs_stat) {
  * buf: name会被复制到buf中
  * name: dentry名字
  * stbuf: 文件状态，可忽略
- * off: 下一次offset从哪里开始，这里可以理解为第几个dentry
+ * off: 下一次offset从哪里开始。这里取刚填充的目录项到链表尾的项数，新目录项插在链表头，
+ *      删除已列出的目录项也不改变未列出项的off，边列目录边删除时不会跳过目录项
  * 
- * @param offset 第几个目录项？
- * @param fi 可忽略
+ * @param offset 0从头开始，否则从距链表尾offset-1项处继续
+ * @param fi opendir在fi->fh中保存的游标，为空时临时解析路径
  * @return int 0成功，否则返回对应错误号
  */
 int newfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t offset,
 			    		 struct fuse_file_info * fi) {
-    /* TODO: 解析路径，获取目录的Inode，并读取目录项，利用filler填充到buf，可参考/fs/simplefs/newfs.c的newfs_readdir()函数实现 */
-     boolean	is_find, is_root;
-	int		cur_dir = offset;
+	struct newfs_dir_cursor  tmp;
+	struct newfs_dir_cursor* cursor = fi != NULL ? (struct newfs_dir_cursor*)(uintptr_t)fi->fh : NULL;
+	boolean	is_find, is_root;
+	int     dir_cnt;
 
-	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
-	struct newfs_dentry* sub_dentry;
-	struct newfs_inode* inode;
-	if (is_find) {
-		inode = dentry->inode;
-		sub_dentry = newfs_get_dentry(inode, cur_dir);
-		if (sub_dentry) {
-			filler(buf, sub_dentry->fname, NULL, ++offset);
+	if (cursor == NULL) {
+		tmp.dir = newfs_lookup(path, &is_find, &is_root);
+		if (tmp.dir == NULL) {
+			return -NEWFS_ERROR_IO;
+		}
+		if (!is_find) {
+			return -NEWFS_ERROR_NOTFOUND;
+		}
+		tmp.next = tmp.dir->inode->dentrys;
+		tmp.pos  = 0;
+		tmp.left = tmp.dir->inode->dir_cnt;
+		cursor   = &tmp;
+	}
+	if (offset != cursor->pos) {					/* 内核只用了上次填充的一部分，或rewinddir/seekdir */
+		dir_cnt      = cursor->dir->inode->dir_cnt;
+		cursor->left = offset == 0 || offset > dir_cnt ? dir_cnt : (int)offset - 1;
+		cursor->next = newfs_get_dentry(cursor->dir->inode, dir_cnt - cursor->left);
+		cursor->pos  = offset;
+	}
+	while (cursor->next != NULL) {					/* 填满buf为止，下次从游标处继续 */
+		if (filler(buf, cursor->next->fname, NULL, cursor->left) != 0) {
+			break;
 		}
-		return NEWFS_ERROR_NONE;
+		cursor->next = cursor->next->brother;
+		cursor->pos  = cursor->left--;
 	}
-	return -NEWFS_ERROR_NOTFOUND;
+	return NEWFS_ERROR_NONE;
 }
 
 /**
@@ -194,6 +393,7 @@ int newfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t o
  * @return int 0成功，否则返回对应错误号
  */
 int newfs_mknod(const char* path, mode_t mode, dev_t dev) {
+	int     ret;
 	boolean	is_find, is_root;
 	
 	struct newfs_dentry* last_dentry = newfs_lookup(path, &is_find, &is_root);
@@ -201,11 +401,20 @@ int newfs_mknod(const char* path, mode_t mode, dev_t dev) {
 	struct newfs_inode* inode;
 	char* fname;
 	
+	if (last_dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
 	if (is_find == TRUE) {
 		return -NEWFS_ERROR_EXISTS;
 	}
+	if (last_dentry->snap != NULL || last_dentry == newfs_super.snap_dentry) {
+		return -NEWFS_ERROR_ROFS;
+	}
 
 	fname = newfs_get_fname(path);
+	if (strlen(fname) >= NEWFS_MAX_FILE_NAME) {
+		return -NEWFS_ERROR_NAMETOOLONG;
+	}
 	
 	if (S_ISREG(mode)) {
 		dentry = new_dentry(fname, NEWFS_FILE);
@@ -216,23 +425,65 @@ int newfs_mknod(const char* path, mode_t mode, dev_t dev) {
 	else {
 		dentry = new_dentry(fname, NEWFS_FILE);
 	}
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
 	dentry->parent = last_dentry;
+	ret = newfs_alloc_dentry(last_dentry->inode, dentry);
+	if (ret < 0) {
+		newfs_free_dentry(dentry);
+		return ret;
+	}
 	inode = newfs_alloc_inode(dentry);
-	newfs_alloc_dentry(last_dentry->inode, dentry);
+	if (inode == NULL) {
+		newfs_drop_dentry(last_dentry->inode, dentry);
+		newfs_free_dentry(dentry);
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	newfs_inode_mtime(last_dentry->inode);
 
 	return NEWFS_ERROR_NONE;
 }
 
 /**
- * @brief 修改时间，为了不让touch报错 
+ * @brief 修改atime和mtime，ctime取当前时间
  * 
  * @param path 相对于挂载点的路径
- * @param tv 实践
+ * @param tv tv[0]为atime，tv[1]为mtime，可为UTIME_NOW或UTIME_OMIT
  * @return int 0成功，否则返回对应错误号
  */
 int newfs_utimens(const char* path, const struct timespec tv[2]) {
-	(void)path;
-	return 0;
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_inode*  inode;
+	struct timespec      now;
+
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (dentry->snap != NULL || dentry == newfs_super.snap_dentry) {
+		return -NEWFS_ERROR_ROFS;
+	}
+	inode = dentry->inode;
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (tv == NULL) {									/* utime(path, NULL) */
+		inode->atime = now;
+		inode->mtime = now;
+	}
+	else {
+		if (tv[0].tv_nsec != UTIME_OMIT) {
+			inode->atime = tv[0].tv_nsec == UTIME_NOW ? now : tv[0];
+		}
+		if (tv[1].tv_nsec != UTIME_OMIT) {
+			inode->mtime = tv[1].tv_nsec == UTIME_NOW ? now : tv[1];
+		}
+	}
+	inode->ctime = now;
+	newfs_inode_dirty(inode);
+	return NEWFS_ERROR_NONE;
 }
 /******************************************************************************
 * SECTION: 选做函数实现
@@ -249,8 +500,96 @@ int newfs_utimens(const char* path, const struct timespec tv[2]) {
  */
 int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		        struct fuse_file_info* fi) {
-	/* 选做 */
-	return size;
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_inode*  inode;
+	size_t   done = 0;
+	int      blk = 0, blk_ofs, len, dno;
+	uint8_t* data;
+	uint64_t h[2];
+
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	inode = dentry->inode;
+	if (NEWFS_IS_DIR(inode)) {
+		return -NEWFS_ERROR_ISDIR;
+	}
+	if (dentry->snap != NULL) {
+		return -NEWFS_ERROR_ROFS;
+	}
+	if (size == 0) {								/* 0字节写什么也不改，尤其不能越过打包/压缩的尾部改size */
+		return 0;
+	}
+	if (newfs_frag_unpack(inode) != NEWFS_ERROR_NONE ||		/* 在下次同步时重新打包/压缩 */
+	    newfs_zip_unpack(inode) != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	newfs_inode_mtime(inode);
+
+	/* 按块拆分写入范围，只拷贝涉及的部分，未分配的块在此时分配 */
+	while (done < size) {
+		blk     = (offset + done) / NEWFS_BLK_SZ();
+		blk_ofs = (offset + done) % NEWFS_BLK_SZ();
+		len     = NEWFS_BLK_SZ() - blk_ofs;
+		if (len > size - done) {
+			len = size - done;
+		}
+		if (blk >= NEWFS_DATA_PER_FILE) {
+			break;
+		}
+		if (newfs_super.is_dedup && len == NEWFS_BLK_SZ()) {	/* 整块写先查指纹，命中则共享已有块 */
+			newfs_dedup_hash((const uint8_t*)buf + done, h);
+			dno = newfs_dedup_find(h, (const uint8_t*)buf + done);
+			if (dno != NEWFS_NULL_BLK) {
+				if (dno != inode->block_pointer[blk]) {
+					newfs_dedup_ref(dno);
+					if (inode->block_pointer[blk] != NEWFS_NULL_BLK) {
+						newfs_free_data(inode->block_pointer[blk]);
+					}
+					inode->block_pointer[blk] = dno;
+					newfs_inode_dirty_blocks(inode);
+				}
+				done += len;
+				continue;
+			}
+		}
+		if (inode->block_pointer[blk] == NEWFS_NULL_BLK) {
+			dno  = newfs_bmap(inode, blk, TRUE);
+			if (dno < 0) {
+				break;
+			}
+			data = newfs_bread(dno, TRUE);
+		}
+		else {
+			dno  = newfs_bunshare(inode, blk, len == NEWFS_BLK_SZ());
+			if (dno < 0) {
+				break;
+			}
+			data = newfs_bread(dno, len == NEWFS_BLK_SZ());
+		}
+		if (data == NULL) {
+			return done > 0 ? done : -NEWFS_ERROR_IO;
+		}
+		memcpy(data + blk_ofs, buf + done, len);
+		newfs_bdirty(dno);
+		if (newfs_super.is_dedup && len == NEWFS_BLK_SZ()) {
+			newfs_dedup_add(h, dno);
+		}
+		done += len;
+	}
+
+	if (offset + done > inode->size) {
+		inode->size = offset + done;
+		newfs_inode_dirty_blocks(inode);
+	}
+	if (done == 0) {
+		return blk >= NEWFS_DATA_PER_FILE ? -NEWFS_ERROR_FBIG : -NEWFS_ERROR_NOSPACE;
+	}
+	return done;
 }
 
 /**
@@ -265,8 +604,69 @@ int newfs_write(const char* path, const char* buf, size_t size, off_t offset,
  */
 int newfs_read(const char* path, char* buf, size_t size, off_t offset,
 		       struct fuse_file_info* fi) {
-	/* 选做 */
-	return size;			   
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_inode*  inode;
+	size_t   done = 0;
+	int      blk, blk_ofs, len, dno;
+	uint8_t* data;
+
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	inode = dentry->inode;
+	if (NEWFS_IS_DIR(inode)) {
+		return -NEWFS_ERROR_ISDIR;
+	}
+	newfs_inode_atime(inode);
+	if (offset >= inode->size) {
+		return 0;
+	}
+	if (offset + size > inode->size) {
+		size = inode->size - offset;
+	}
+	if (NEWFS_IS_ZIP(inode)) {							/* 整簇解压后拷贝 */
+		data = newfs_zip_load(inode);
+		if (data == NULL) {
+			return -NEWFS_ERROR_IO;
+		}
+		memcpy(buf, data + offset, size);
+		return size;
+	}
+
+	while (done < size) {
+		blk     = (offset + done) / NEWFS_BLK_SZ();
+		blk_ofs = (offset + done) % NEWFS_BLK_SZ();
+		len     = NEWFS_BLK_SZ() - blk_ofs;
+		if (len > size - done) {
+			len = size - done;
+		}
+		if (inode->frag_blk != NEWFS_NULL_BLK && blk == inode->size / NEWFS_BLK_SZ()) {
+			data = newfs_bread(inode->frag_blk, FALSE);		/* 尾部位于碎片块 */
+			if (data == NULL) {
+				return done > 0 ? done : -NEWFS_ERROR_IO;
+			}
+			memcpy(buf + done, data + inode->frag_ofs + blk_ofs, len);
+			done += len;
+			continue;
+		}
+		dno = newfs_bmap(inode, blk, FALSE);
+		if (dno == NEWFS_NULL_BLK) {						/* 空洞读为0 */
+			memset(buf + done, 0, len);
+		}
+		else {
+			data = dno < 0 ? NULL : newfs_bread(dno, FALSE);
+			if (data == NULL) {
+				return done > 0 ? done : -NEWFS_ERROR_IO;
+			}
+			memcpy(buf + done, data + blk_ofs, len);
+		}
+		done += len;
+	}
+	return done;			   
 }
 
 /**
@@ -276,8 +676,122 @@ int newfs_read(const char* path, char* buf, size_t size, off_t offset,
  * @return int 0成功，否则返回对应错误号
  */
 int newfs_unlink(const char* path) {
-	/* 选做 */
-	return 0;
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_dentry* parent;
+	struct newfs_inode*  inode;
+	int    ret;
+
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (is_root || dentry->snap != NULL || dentry == newfs_super.snap_dentry) {
+		return -NEWFS_ERROR_ROFS;
+	}
+	inode = dentry->inode;
+	if (NEWFS_IS_DIR(inode)) {
+		return -NEWFS_ERROR_ISDIR;
+	}
+	parent = dentry->parent;
+	ret = newfs_drop_dentry(parent->inode, dentry);
+	if (ret < 0) {
+		return ret;
+	}
+	newfs_inode_mtime(parent->inode);
+
+	inode->link--;
+	clock_gettime(CLOCK_REALTIME, &inode->ctime);
+	newfs_inode_dirty(inode);
+	if (inode->link > 0 && inode->dentry == dentry && dentry->alias == NULL) {
+		/* 其余名字所在的目录项未载入，先写回链接数，之后经其他名字重新读入 */
+		if (newfs_sync_inode(inode) != NEWFS_ERROR_NONE) {
+			NEWFS_DBG("[%s] sync ino %d failed\n", __func__, inode->ino);
+		}
+	}
+	newfs_icache_detach(dentry);
+	newfs_free_dentry(dentry);
+	if (inode->link == 0) {
+		newfs_free_inode(inode);
+	}
+	else if (inode->dentry == NULL) {
+		newfs_icache_remove(inode);
+	}
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 为普通文件建立硬链接，两个名字共用同一inode
+ * 
+ * @param from 已存在的文件路径
+ * @param to 新名字的路径
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_link(const char* from, const char* to) {
+	int     ret;
+	boolean	is_find, is_root;
+	struct newfs_dentry* src = newfs_lookup(from, &is_find, &is_root);
+	struct newfs_dentry* last_dentry;
+	struct newfs_dentry* dentry;
+	struct newfs_inode*  inode;
+	char* fname;
+
+	if (src == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (src->snap != NULL || src == newfs_super.snap_dentry) {
+		return -NEWFS_ERROR_ROFS;
+	}
+	inode = src->inode;
+	if (NEWFS_IS_DIR(inode)) {
+		return -NEWFS_ERROR_PERM;
+	}
+	if (inode->link >= NEWFS_LINK_MAX) {
+		return -NEWFS_ERROR_MLINK;
+	}
+
+	newfs_iget(inode);								/* 第二次查找可能淘汰inode */
+	last_dentry = newfs_lookup(to, &is_find, &is_root);
+	newfs_iput(inode);
+	if (last_dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == TRUE) {
+		return -NEWFS_ERROR_EXISTS;
+	}
+	if (last_dentry->snap != NULL || last_dentry == newfs_super.snap_dentry) {
+		return -NEWFS_ERROR_ROFS;
+	}
+	if (NEWFS_IS_REG(last_dentry->inode)) {
+		return -NEWFS_ERROR_UNSUPPORTED;
+	}
+	fname = newfs_get_fname(to);
+	if (strlen(fname) >= NEWFS_MAX_FILE_NAME) {
+		return -NEWFS_ERROR_NAMETOOLONG;
+	}
+
+	dentry = new_dentry(fname, NEWFS_FILE);
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	dentry->parent = last_dentry;
+	dentry->ino    = inode->ino;
+	ret = newfs_alloc_dentry(last_dentry->inode, dentry);
+	if (ret < 0) {
+		newfs_free_dentry(dentry);
+		return ret;
+	}
+	newfs_icache_attach(inode, dentry);
+	inode->link++;
+	clock_gettime(CLOCK_REALTIME, &inode->ctime);
+	newfs_inode_dirty(inode);
+	newfs_inode_mtime(last_dentry->inode);
+	return NEWFS_ERROR_NONE;
 }
 
 /**
@@ -330,8 +844,96 @@ int newfs_open(const char* path, struct fuse_file_info* fi) {
  * @return int 0成功，否则返回对应错误号
  */
 int newfs_opendir(const char* path, struct fuse_file_info* fi) {
-	/* 选做 */
-	return 0;
+	boolean	is_find, is_root;
+	struct newfs_dentry*     dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_dir_cursor* cursor;
+
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	cursor = (struct newfs_dir_cursor*)newfs_slab_alloc(&cursor_slab);
+	if (cursor == NULL) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	cursor->dir  = dentry;							/* 整个列目录过程只解析一次路径 */
+	cursor->next = dentry->inode->dentrys;
+	cursor->pos  = 0;
+	cursor->left = dentry->inode->dir_cnt;
+	cursor->link = dentry->inode->cursors;			/* 删除目录项时据此调整游标 */
+	dentry->inode->cursors = cursor;
+	newfs_iget(dentry->inode);						/* 游标持有目录，目录项在releasedir前不会被淘汰 */
+	fi->fh = (uint64_t)(uintptr_t)cursor;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 关闭目录文件，释放opendir分配的游标
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_releasedir(const char* path, struct fuse_file_info* fi) {
+	struct newfs_dir_cursor*  cursor = (struct newfs_dir_cursor*)(uintptr_t)fi->fh;
+	struct newfs_dir_cursor** link;
+
+	if (cursor != NULL) {
+		for (link = &cursor->dir->inode->cursors; *link != cursor; link = &(*link)->link);
+		*link = cursor->link;
+		newfs_iput(cursor->dir->inode);
+	}
+	newfs_slab_free(&cursor_slab, cursor);
+	fi->fh = 0;
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 把文件的脏数据及找到它所需的元数据写到磁盘，代价只与该文件的修改量有关
+ * 
+ * @param path 相对于挂载点的路径
+ * @param datasync 非0时为fdatasync，只有数据变化时不写inode
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	if (dentry->snap != NULL || dentry == newfs_super.snap_dentry) {
+		return NEWFS_ERROR_NONE;							/* 快照只读，没有脏数据 */
+	}
+	return newfs_fsync_inode(dentry->inode, datasync ? TRUE : FALSE);
+}
+
+/**
+ * @brief 每次close时调用。写回推迟到检查点，需要持久化的应用应调用fsync
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_flush(const char* path, struct fuse_file_info* fi) {
+	return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 文件的最后一个句柄关闭，没有按句柄分配的状态需要释放
+ * 
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则返回对应错误号
+ */
+int newfs_release(const char* path, struct fuse_file_info* fi) {
+	return NEWFS_ERROR_NONE;
 }
 
 /**
@@ -342,8 +944,56 @@ int newfs_opendir(const char* path, struct fuse_file_info* fi) {
  * @return int 0成功，否则返回对应错误号
  */
 int newfs_truncate(const char* path, off_t offset) {
-	/* 选做 */
-	return 0;
+	boolean	is_find, is_root;
+	struct newfs_dentry* dentry = newfs_lookup(path, &is_find, &is_root);
+	struct newfs_inode*  inode;
+	int      blk, keep_blks, tail, dno;
+	uint8_t* data;
+
+	if (dentry == NULL) {
+		return -NEWFS_ERROR_IO;
+	}
+	if (is_find == FALSE) {
+		return -NEWFS_ERROR_NOTFOUND;
+	}
+	inode = dentry->inode;
+	if (NEWFS_IS_DIR(inode)) {
+		return -NEWFS_ERROR_ISDIR;
+	}
+	if (dentry->snap != NULL) {
+		return -NEWFS_ERROR_ROFS;
+	}
+	if (offset > NEWFS_BLKS_SZ(NEWFS_DATA_PER_FILE)) {
+		return -NEWFS_ERROR_FBIG;
+	}
+	if (newfs_frag_unpack(inode) != NEWFS_ERROR_NONE ||
+	    newfs_zip_unpack(inode) != NEWFS_ERROR_NONE) {
+		return -NEWFS_ERROR_NOSPACE;
+	}
+	newfs_inode_mtime(inode);
+
+	/* 释放新大小之后的整块，并把保留的最后一块中超出部分清零 */
+	keep_blks = NEWFS_ROUND_UP(offset, NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
+	for (blk = keep_blks; blk < NEWFS_DATA_PER_FILE; blk++) {
+		if (inode->block_pointer[blk] != NEWFS_NULL_BLK) {
+			newfs_free_data(inode->block_pointer[blk]);
+			inode->block_pointer[blk] = NEWFS_NULL_BLK;
+		}
+	}
+	tail = offset % NEWFS_BLK_SZ();
+	if (tail != 0 && offset < inode->size && 
+	    inode->block_pointer[offset / NEWFS_BLK_SZ()] != NEWFS_NULL_BLK) {
+		dno = newfs_bunshare(inode, offset / NEWFS_BLK_SZ(), FALSE);	/* 共享块先复制 */
+		data = dno < 0 ? NULL : newfs_bread(dno, FALSE);
+		if (data == NULL) {
+			return dno < 0 ? dno : -NEWFS_ERROR_IO;
+		}
+		memset(data + tail, 0, NEWFS_BLK_SZ() - tail);
+		newfs_bdirty(dno);
+	}
+	inode->size = offset;
+	newfs_inode_dirty_blocks(inode);
+	return NEWFS_ERROR_NONE;
 }
 
 
@@ -375,6 +1025,12 @@ int main(int argc, char **argv)
 
 	if (fuse_opt_parse(&args, &newfs_options, option_spec, NULL) == -1)
 		return -1;
+	/* 编译器、动态链接器会反复探测不存在的路径，插在最前面，用户给出的-o negative_timeout在后生效 */
+	if (fuse_opt_insert_arg(&args, 1, NEWFS_NEGATIVE_TIMEOUT) == -1)
+		return -1;
+	/* 内存结构(slab、各级缓存)只有一把newfs_lock，强制FUSE单线程派发回调，只与提交线程互斥 */
+	if (fuse_opt_add_arg(&args, "-s") == -1)
+		return -1;
 	
 	ret = fuse_main(args.argc, args.argv, &operations, NULL);
 	fuse_opt_free_args(&args);
@@ -0,0 +1,320 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+/******************************************************************************
+* SECTION: 块缓存
+* 以数据块号dno为键缓存数据区的逻辑块，LRU替换，脏块在淘汰或flush时整块写回。
+* inode表块也经此缓存，键为相对数据区的块号(NEWFS_ITAB_DNO)，原inode区中的块号为负数。
+* 脏块另串成按首次变脏先后排列的链表，flush只遍历该链表，耗时与修改量而非缓存大小成正比。
+* 启用日志时，inode表块、目录块和碎片块由newfs_bdirty_meta标记为元数据，提交到日志前不能原地写回:
+* 淘汰时跳过、flush时保留，由newfs_journal_commit记入日志后转为普通脏块。
+*******************************************************************************/
+static struct newfs_buf*  bufs;             /* 缓存项数组 */
+static uint8_t*           buf_area;         /* 所有缓存块的连续内存 */
+static struct newfs_buf** buf_hash;         /* dno -> 缓存项的哈希桶 */
+static int                buf_cnt;
+static int                buf_hash_mask;
+static struct newfs_buf   buf_lru;          /* LRU哨兵，next为最近使用，prev为最久未用 */
+static struct newfs_buf   buf_dirty;        /* 脏块链表哨兵，next为最早变脏 */
+static int                buf_meta_cnt;     /* 未提交的元数据块数 */
+
+static inline void newfs_buf_lru_del(struct newfs_buf* buf) {
+    buf->lru_prev->lru_next = buf->lru_next;
+    buf->lru_next->lru_prev = buf->lru_prev;
+}
+
+static inline void newfs_buf_lru_add(struct newfs_buf* buf) {
+    buf->lru_next = buf_lru.lru_next;
+    buf->lru_prev = &buf_lru;
+    buf_lru.lru_next->lru_prev = buf;
+    buf_lru.lru_next = buf;
+}
+
+static inline void newfs_buf_dirty_del(struct newfs_buf* buf) {
+    if (buf->flags & NEWFS_FLAG_BUF_DIRTY) {
+        buf->dirty_prev->dirty_next = buf->dirty_next;
+        buf->dirty_next->dirty_prev = buf->dirty_prev;
+        buf->flags &= ~NEWFS_FLAG_BUF_DIRTY;
+    }
+    if (buf->flags & NEWFS_FLAG_BUF_META) {
+        buf->flags &= ~NEWFS_FLAG_BUF_META;
+        buf_meta_cnt--;
+    }
+}
+
+static inline void newfs_buf_hash_del(struct newfs_buf* buf) {
+    struct newfs_buf** pprev = &buf_hash[buf->dno & buf_hash_mask];
+    while (*pprev != NULL) {
+        if (*pprev == buf) {
+            *pprev = buf->hash_next;
+            break;
+        }
+        pprev = &(*pprev)->hash_next;
+    }
+    buf->hash_next = NULL;
+}
+
+static inline void newfs_buf_hash_add(struct newfs_buf* buf) {
+    buf->hash_next = buf_hash[buf->dno & buf_hash_mask];
+    buf_hash[buf->dno & buf_hash_mask] = buf;
+}
+
+static struct newfs_buf* newfs_buf_find(int dno) {
+    struct newfs_buf* buf = buf_hash[dno & buf_hash_mask];
+    while (buf != NULL && buf->dno != dno) {
+        buf = buf->hash_next;
+    }
+    return buf;
+}
+
+/**
+ * @brief 将脏缓存块写回数据区
+ *
+ * @param buf
+ * @return int
+ */
+static int newfs_buf_writeback(struct newfs_buf* buf) {
+    if (!(buf->flags & NEWFS_FLAG_BUF_DIRTY) || (buf->flags & NEWFS_FLAG_BUF_META)) {
+        return NEWFS_ERROR_NONE;
+    }
+    if (newfs_driver_write(NEWFS_DATA_OFS(buf->dno), buf->data,
+                           NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+        NEWFS_DBG("[%s] io error\n", __func__);
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_buf_dirty_del(buf);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 初始化块缓存，需在块大小确定后调用
+ *
+ * @param nbufs 缓存块数
+ * @return int
+ */
+int newfs_cache_init(int nbufs) {
+    int i;
+    int hash_sz = 1;
+
+    while (hash_sz < 2 * nbufs) {
+        hash_sz <<= 1;
+    }
+    bufs     = (struct newfs_buf*)calloc(nbufs, sizeof(struct newfs_buf));
+    if (posix_memalign((void**)&buf_area, NEWFS_CACHELINE, NEWFS_BLKS_SZ(nbufs)) != 0) {
+        buf_area = NULL;
+    }
+    buf_hash = (struct newfs_buf**)calloc(hash_sz, sizeof(struct newfs_buf*));
+    if (bufs == NULL || buf_area == NULL || buf_hash == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    buf_cnt       = nbufs;
+    buf_hash_mask = hash_sz - 1;
+    buf_lru.lru_next = &buf_lru;
+    buf_lru.lru_prev = &buf_lru;
+    buf_dirty.dirty_next = &buf_dirty;
+    buf_dirty.dirty_prev = &buf_dirty;
+    buf_meta_cnt = 0;
+    for (i = 0; i < nbufs; i++) {
+        bufs[i].dno  = NEWFS_NULL_BLK;
+        bufs[i].data = buf_area + NEWFS_BLKS_SZ(i);
+        newfs_buf_lru_add(&bufs[i]);
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 释放块缓存，调用前应先newfs_bflush
+ */
+void newfs_cache_destroy() {
+    free(bufs);
+    free(buf_area);
+    free(buf_hash);
+    bufs     = NULL;
+    buf_area = NULL;
+    buf_hash = NULL;
+    buf_cnt  = 0;
+}
+
+/**
+ * @brief 获取数据块dno的缓存内容，未命中时淘汰LRU块并从磁盘读入
+ *
+ * 返回的指针在下一次newfs_bread之前有效
+ *
+ * @param dno 数据块号
+ * @param is_new TRUE表示调用者将覆盖整块(或新分配的块)，无需读盘，内容清零
+ * @return uint8_t*
+ */
+uint8_t* newfs_bread(int dno, boolean is_new) {
+    struct newfs_buf* buf = newfs_buf_find(dno);
+
+    if (buf != NULL) {
+        newfs_buf_lru_del(buf);
+        newfs_buf_lru_add(buf);
+        if (is_new) {
+            memset(buf->data, 0, NEWFS_BLK_SZ());
+        }
+        return buf->data;
+    }
+
+    buf = buf_lru.lru_prev;                                 /* 淘汰最久未用的块，未提交的元数据块除外 */
+    while (buf != &buf_lru && (buf->flags & NEWFS_FLAG_BUF_META)) {
+        buf = buf->lru_prev;
+    }
+    if (buf == &buf_lru) {
+        NEWFS_DBG("[%s] all buffers hold uncommitted metadata\n", __func__);
+        return NULL;
+    }
+    if (newfs_buf_writeback(buf) != NEWFS_ERROR_NONE) {
+        return NULL;
+    }
+    if (buf->flags & NEWFS_FLAG_BUF_OCCUPY) {
+        newfs_buf_hash_del(buf);
+    }
+
+    if (is_new) {
+        memset(buf->data, 0, NEWFS_BLK_SZ());
+    }
+    else if (newfs_driver_read(NEWFS_DATA_OFS(dno), buf->data,
+                               NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+        NEWFS_DBG("[%s] io error\n", __func__);
+        buf->dno   = NEWFS_NULL_BLK;
+        buf->flags = 0;
+        return NULL;
+    }
+    buf->dno   = dno;
+    buf->flags = NEWFS_FLAG_BUF_OCCUPY;
+    newfs_buf_hash_add(buf);
+    newfs_buf_lru_del(buf);
+    newfs_buf_lru_add(buf);
+    return buf->data;
+}
+
+/**
+ * @brief 标记缓存中的数据块为脏，dno必须已由newfs_bread读入
+ *
+ * @param dno
+ */
+void newfs_bdirty(int dno) {
+    struct newfs_buf* buf = newfs_buf_find(dno);
+    if (buf != NULL && !(buf->flags & NEWFS_FLAG_BUF_DIRTY)) {
+        buf->flags |= NEWFS_FLAG_BUF_DIRTY;
+        buf->dirty_next = &buf_dirty;
+        buf->dirty_prev = buf_dirty.dirty_prev;
+        buf_dirty.dirty_prev->dirty_next = buf;
+        buf_dirty.dirty_prev = buf;
+    }
+}
+
+/**
+ * @brief 标记缓存中的元数据块(inode表块、目录块)为脏，启用日志时在提交前不原地写回
+ *
+ * @param dno
+ */
+void newfs_bdirty_meta(int dno) {
+    struct newfs_buf* buf = newfs_buf_find(dno);
+
+    newfs_bdirty(dno);
+    if (buf != NULL && newfs_super.is_journal && !(buf->flags & NEWFS_FLAG_BUF_META)) {
+        buf->flags |= NEWFS_FLAG_BUF_META;
+        buf_meta_cnt++;
+    }
+}
+
+/**
+ * @brief 未提交的元数据块数，用于决定何时提交日志
+ *
+ * @return int
+ */
+int newfs_bmeta_cnt() {
+    return buf_meta_cnt;
+}
+
+/**
+ * @brief 按首次变脏的先后取出所有未提交的元数据块
+ *
+ * @param dnos 输出块号
+ * @param datas 输出缓存内容，在下一次newfs_bread之前有效
+ * @param max 数组容量
+ * @return int 块数，超过max时返回-1
+ */
+int newfs_bmeta_collect(int* dnos, uint8_t** datas, int max) {
+    struct newfs_buf* buf;
+    int cnt = 0;
+
+    for (buf = buf_dirty.dirty_next; buf != &buf_dirty; buf = buf->dirty_next) {
+        if (!(buf->flags & NEWFS_FLAG_BUF_META)) {
+            continue;
+        }
+        if (cnt == max) {
+            return -1;
+        }
+        dnos[cnt]  = buf->dno;
+        datas[cnt] = buf->data;
+        cnt++;
+    }
+    return cnt;
+}
+
+/**
+ * @brief 元数据块已记入日志，转为普通脏块，此后可随时原地写回
+ */
+void newfs_bmeta_commit() {
+    struct newfs_buf* buf;
+
+    for (buf = buf_dirty.dirty_next; buf != &buf_dirty; buf = buf->dirty_next) {
+        buf->flags &= ~NEWFS_FLAG_BUF_META;
+    }
+    buf_meta_cnt = 0;
+}
+
+/**
+ * @brief 丢弃数据块dno的缓存(块被释放时调用)，脏内容不写回
+ *
+ * @param dno
+ */
+void newfs_binval(int dno) {
+    struct newfs_buf* buf = newfs_buf_find(dno);
+    if (buf == NULL) {
+        return;
+    }
+    newfs_buf_dirty_del(buf);
+    newfs_buf_hash_del(buf);
+    buf->dno   = NEWFS_NULL_BLK;
+    buf->flags = 0;
+    newfs_buf_lru_del(buf);                                 /* 空闲块优先被复用 */
+    buf->lru_next = &buf_lru;
+    buf->lru_prev = buf_lru.lru_prev;
+    buf_lru.lru_prev->lru_next = buf;
+    buf_lru.lru_prev = buf;
+}
+
+/**
+ * @brief 只写回数据块dno，不在缓存中或是干净的则什么也不做，供fsync使用
+ *
+ * @param dno
+ * @return int
+ */
+int newfs_bsync(int dno) {
+    struct newfs_buf* buf = newfs_buf_find(dno);
+    return buf == NULL ? NEWFS_ERROR_NONE : newfs_buf_writeback(buf);
+}
+
+/**
+ * @brief 按首次变脏的先后写回所有脏缓存块，未提交的元数据块留在缓存中
+ *
+ * @return int
+ */
+int newfs_bflush() {
+    struct newfs_buf* buf = buf_dirty.dirty_next;
+    struct newfs_buf* next;
+
+    while (buf != &buf_dirty) {
+        next = buf->dirty_next;
+        if (newfs_buf_writeback(buf) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+        buf = next;
+    }
+    return NEWFS_ERROR_NONE;
+}
@@ -0,0 +1,297 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+/******************************************************************************
+* SECTION: 块级去重
+* 写整块时计算128位指纹，在指纹索引中查找内容相同的数据块并直接共享。
+* 指纹索引是NEWFS_DEDUP_WAYS路组相联的表，容量固定，冲突时轮换淘汰；
+* 索引项只在对应块的fp_valid位有效且内容逐字节相同时才命中，因此无需在块被改写时删除。
+* 共享块的引用计数不落盘，挂载时扫描inode表重建。
+*******************************************************************************/
+struct newfs_fp {
+    uint64_t           h[2];
+    int                dno;
+};
+
+static struct newfs_fp* fp_table;           /* 指纹索引 */
+static int              fp_sets;
+static uint8_t*         fp_valid;           /* 每个数据块一位，块释放时清除 */
+static uint8_t*         fp_victim;          /* 每组下一个被淘汰的路 */
+static uint16_t*        refs;               /* 每个数据块除所有者外的引用数 */
+
+static inline uint64_t newfs_rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t newfs_fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/**
+ * @brief MurmurHash3 x64_128，块大小总是16的倍数，不处理尾部
+ *
+ * @param data 一个数据块
+ * @param h 输出128位指纹
+ */
+void newfs_dedup_hash(const uint8_t* data, uint64_t h[2]) {
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = 0, h2 = 0, k1, k2;
+    int      i, len = NEWFS_BLK_SZ();
+
+    for (i = 0; i < len; i += 16) {
+        memcpy(&k1, data + i, sizeof(k1));
+        memcpy(&k2, data + i + 8, sizeof(k2));
+        k1 *= c1; k1 = newfs_rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = newfs_rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = newfs_rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = newfs_rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+    h1 ^= len;
+    h2 ^= len;
+    h1 += h2;
+    h2 += h1;
+    h1 = newfs_fmix64(h1);
+    h2 = newfs_fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    h[0] = h1;
+    h[1] = h2;
+}
+
+static inline boolean newfs_fp_is_valid(int dno) {
+    return (fp_valid[dno / UINT8_BITS] & (0x1 << (dno % UINT8_BITS))) != 0;
+}
+
+/**
+ * @brief 查找内容与data相同的数据块
+ *
+ * @param h data的指纹
+ * @param data
+ * @return int 数据块号，未命中返回NEWFS_NULL_BLK
+ */
+int newfs_dedup_find(const uint64_t h[2], const uint8_t* data) {
+    struct newfs_fp* set;
+    uint8_t*         blk;
+    int              way;
+
+    if (fp_table == NULL) {
+        return NEWFS_NULL_BLK;
+    }
+    set = &fp_table[(h[0] & (fp_sets - 1)) * NEWFS_DEDUP_WAYS];
+    for (way = 0; way < NEWFS_DEDUP_WAYS; way++) {
+        if (set[way].dno == NEWFS_NULL_BLK || set[way].h[0] != h[0] || set[way].h[1] != h[1] ||
+            !newfs_fp_is_valid(set[way].dno) || refs[set[way].dno] == UINT16_MAX) {
+            continue;
+        }
+        blk = newfs_bread(set[way].dno, FALSE);
+        if (blk != NULL && memcmp(blk, data, NEWFS_BLK_SZ()) == 0) {
+            return set[way].dno;
+        }
+        set[way].dno = NEWFS_NULL_BLK;                      /* 块已被改写 */
+    }
+    return NEWFS_NULL_BLK;
+}
+
+/**
+ * @brief 把数据块dno以指纹h加入索引
+ *
+ * @param h
+ * @param dno
+ */
+void newfs_dedup_add(const uint64_t h[2], int dno) {
+    struct newfs_fp* set;
+    int              s, way;
+
+    if (fp_table == NULL) {
+        return;
+    }
+    s   = h[0] & (fp_sets - 1);
+    set = &fp_table[s * NEWFS_DEDUP_WAYS];
+    for (way = 0; way < NEWFS_DEDUP_WAYS; way++) {
+        if (set[way].dno == dno || set[way].dno == NEWFS_NULL_BLK ||
+            !newfs_fp_is_valid(set[way].dno)) {
+            break;
+        }
+    }
+    if (way == NEWFS_DEDUP_WAYS) {
+        way = fp_victim[s];
+        fp_victim[s] = (way + 1) % NEWFS_DEDUP_WAYS;
+    }
+    set[way].h[0] = h[0];
+    set[way].h[1] = h[1];
+    set[way].dno  = dno;
+    fp_valid[dno / UINT8_BITS] |= (0x1 << (dno % UINT8_BITS));
+}
+
+/**
+ * @brief 增加一个对数据块dno的共享引用
+ *
+ * @param dno
+ */
+void newfs_dedup_ref(int dno) {
+    refs[dno]++;
+}
+
+/**
+ * @brief 数据块是否被多个指针共享，共享块写前须复制
+ *
+ * @param dno
+ * @return boolean
+ */
+boolean newfs_dedup_shared(int dno) {
+    return refs != NULL && refs[dno] > 0;
+}
+
+/**
+ * @brief 释放数据块前调用，去掉一个引用
+ *
+ * @param dno
+ * @return boolean TRUE表示仍有其他引用，块不能释放
+ */
+boolean newfs_dedup_unref(int dno) {
+    if (refs == NULL) {
+        return FALSE;
+    }
+    if (refs[dno] > 0) {
+        refs[dno]--;
+        return TRUE;
+    }
+    if (fp_valid != NULL) {
+        fp_valid[dno / UINT8_BITS] &= (uint8_t)(~(0x1 << (dno % UINT8_BITS)));
+    }
+    return FALSE;
+}
+
+/**
+ * @brief 扫描inode表，重建引用计数，并在启用去重时为普通文件的整块重建指纹索引
+ *
+ * 只读取含有已分配inode的inode表块，索引最多读入其容量个数据块
+ *
+ * @param is_index 是否重建指纹索引
+ * @return int
+ */
+static int newfs_dedup_scan(boolean is_index) {
+    struct newfs_inode_d2 inode_d;
+    int                   map_sz  = NEWFS_ROUND_UP(newfs_super.max_data, UINT8_BITS) / UINT8_BITS;
+    uint8_t*              buf     = (uint8_t*)malloc(NEWFS_BLK_SZ());
+    uint8_t*              seen    = (uint8_t*)calloc(map_sz, 1);
+    uint8_t*              data;
+    uint64_t              h[2];
+    int                   per_blk = NEWFS_INODE_PER_BLK();
+    int                   budget  = is_index ? NEWFS_DEDUP_ENTRIES : 0;
+    int                   ret     = NEWFS_ERROR_NONE;
+    int                   blk, ino, i, dno, full_blks;
+    boolean               is_used;
+
+    if (buf == NULL || seen == NULL) {
+        free(buf);
+        free(seen);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (blk = 0; blk * per_blk < newfs_super.max_ino && ret == NEWFS_ERROR_NONE; blk++) {
+        for (is_used = FALSE, ino = blk * per_blk; ino < (blk + 1) * per_blk && ino < newfs_super.max_ino; ino++) {
+            if (newfs_super.map_inode[ino / UINT8_BITS] & (0x1 << (ino % UINT8_BITS))) {
+                is_used = TRUE;
+                break;
+            }
+        }
+        if (!is_used) {
+            continue;
+        }
+        if (newfs_driver_read(NEWFS_BLKS_SZ(newfs_super.imap[blk]), buf,
+                              NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+            ret = -NEWFS_ERROR_IO;
+            break;
+        }
+        for (ino = blk * per_blk; ino < (blk + 1) * per_blk && ino < newfs_super.max_ino; ino++) {
+            if (!(newfs_super.map_inode[ino / UINT8_BITS] & (0x1 << (ino % UINT8_BITS)))) {
+                continue;
+            }
+            if (newfs_inode_decode(buf, ino, &inode_d) != NEWFS_ERROR_NONE) {
+                continue;
+            }
+            full_blks = inode_d.ftype == NEWFS_FILE && inode_d.zlen == 0 ?
+                        inode_d.size / NEWFS_BLK_SZ() : 0;
+            for (i = 0; i < NEWFS_DATA_PER_FILE; i++) {
+                dno = inode_d.block_pointer[i];
+                if (dno < 0 || dno >= newfs_super.max_data) {
+                    continue;
+                }
+                /* 第一次出现的指针是所有者，之后每出现一次加一个引用 */
+                if (seen[dno / UINT8_BITS] & (0x1 << (dno % UINT8_BITS))) {
+                    refs[dno]++;
+                    continue;
+                }
+                seen[dno / UINT8_BITS] |= (0x1 << (dno % UINT8_BITS));
+                if (i >= full_blks || budget == 0) {
+                    continue;
+                }
+                data = newfs_bread(dno, FALSE);
+                if (data == NULL) {
+                    ret = -NEWFS_ERROR_IO;
+                    break;
+                }
+                newfs_dedup_hash(data, h);
+                newfs_dedup_add(h, dno);
+                budget--;
+            }
+        }
+    }
+    free(buf);
+    free(seen);
+    return ret;
+}
+
+/**
+ * @brief 初始化去重，需在位图和块缓存就绪后调用
+ *
+ * @param is_enable 本次挂载是否对写入去重
+ * @param is_shared 磁盘上是否可能存在共享块(曾以去重方式挂载)
+ * @return int
+ */
+int newfs_dedup_init(boolean is_enable, boolean is_shared) {
+    int i, map_sz = NEWFS_ROUND_UP(newfs_super.max_data, UINT8_BITS) / UINT8_BITS;
+
+    fp_table  = NULL;
+    fp_victim = NULL;
+    fp_valid  = NULL;
+    refs      = NULL;
+    if (!is_enable && !is_shared) {
+        return NEWFS_ERROR_NONE;
+    }
+    fp_sets  = NEWFS_DEDUP_ENTRIES / NEWFS_DEDUP_WAYS;
+    refs     = (uint16_t*)calloc(newfs_super.max_data, sizeof(uint16_t));
+    fp_valid = (uint8_t*)calloc(map_sz, 1);
+    if (refs == NULL || fp_valid == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    if (is_enable) {
+        fp_table  = (struct newfs_fp*)malloc(NEWFS_DEDUP_ENTRIES * sizeof(struct newfs_fp));
+        fp_victim = (uint8_t*)calloc(fp_sets, 1);
+        if (fp_table == NULL || fp_victim == NULL) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        for (i = 0; i < NEWFS_DEDUP_ENTRIES; i++) {
+            fp_table[i].dno = NEWFS_NULL_BLK;
+        }
+    }
+    return is_shared ? newfs_dedup_scan(is_enable) : NEWFS_ERROR_NONE;
+}
+
+void newfs_dedup_destroy() {
+    free(fp_table);
+    free(fp_victim);
+    free(fp_valid);
+    free(refs);
+    fp_table  = NULL;
+    fp_victim = NULL;
+    fp_valid  = NULL;
+    refs      = NULL;
+}
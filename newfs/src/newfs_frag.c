@@ -0,0 +1,290 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+/******************************************************************************
+* SECTION: 尾部打包
+* 小文件最后不满一块的部分(尾部)存放在共享的碎片块中，由(块号, 偏移, 长度)寻址。
+* 碎片块被划分为NEWFS_FRAG_UNITS个单元，单元0存放newfs_frag_d头部(占用位图和
+* 链表指针)，所有碎片块通过头部的next串成链表，链表头记录在超级块中。
+* 启用日志时碎片块(头部连同其中的尾部)整块作为元数据记入日志，链表在每次提交前重写，
+* 链表头随超级块映像一起提交，重放后沿链表载入的总是与位图一致的碎片块集合。
+*******************************************************************************/
+static int*      frag_dnos;                 /* 所有碎片块的块号 */
+static uint32_t* frag_maps;                 /* 与frag_dnos对应的单元占用位图 */
+static int       frag_cnt;
+static int       frag_cap;
+static boolean   frag_relink;               /* 碎片块集合有变化，需重写链表 */
+
+static int newfs_frag_append(int dno, uint32_t map) {
+    if (frag_cnt == frag_cap) {
+        int       cap  = frag_cap == 0 ? 16 : frag_cap * 2;
+        int*      dnos = (int*)realloc(frag_dnos, cap * sizeof(int));
+        uint32_t* maps = (uint32_t*)realloc(frag_maps, cap * sizeof(uint32_t));
+        if (dnos == NULL || maps == NULL) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        frag_dnos = dnos;
+        frag_maps = maps;
+        frag_cap  = cap;
+    }
+    frag_dnos[frag_cnt] = dno;
+    frag_maps[frag_cnt] = map;
+    frag_cnt++;
+    return frag_cnt - 1;
+}
+
+/**
+ * @brief 在单元位图中查找连续units个空闲单元(单元0为头部)
+ *
+ * @return int 起始单元号，找不到返回-1
+ */
+static int newfs_frag_find_run(uint32_t map, int units) {
+    int unit, start = 1, len = 0;
+    for (unit = 1; unit < NEWFS_FRAG_UNITS; unit++) {
+        if (map & (0x1U << unit)) {
+            start = unit + 1;
+            len   = 0;
+        }
+        else if (++len == units) {
+            return start;
+        }
+    }
+    return -1;
+}
+
+static inline uint32_t newfs_frag_mask(int ofs, int len) {
+    int units = NEWFS_ROUND_UP(len, NEWFS_FRAG_SZ()) / NEWFS_FRAG_SZ();
+    return (uint32_t)(((1ULL << units) - 1) << (ofs / NEWFS_FRAG_SZ()));
+}
+
+/**
+ * @brief 挂载时沿超级块记录的链表载入所有碎片块的占用位图
+ *
+ * @param head 第一个碎片块，NEWFS_NULL_BLK表示没有
+ * @return int
+ */
+int newfs_frag_init(int head) {
+    struct newfs_frag_d* hdr;
+    int dno = head;
+
+    frag_dnos   = NULL;
+    frag_maps   = NULL;
+    frag_cnt    = 0;
+    frag_cap    = 0;
+    frag_relink = FALSE;
+    while (dno != NEWFS_NULL_BLK) {
+        hdr = (struct newfs_frag_d*)newfs_bread(dno, FALSE);
+        if (hdr == NULL) {
+            return -NEWFS_ERROR_IO;
+        }
+        if (hdr->magic != NEWFS_FRAG_MAGIC) {
+            NEWFS_DBG("[%s] bad fragment block %d\n", __func__, dno);
+            return -NEWFS_ERROR_IO;
+        }
+        if (newfs_frag_append(dno, hdr->map) < 0) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        dno = hdr->next;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 重写碎片块链表(仅在集合变化时)，返回链表头，由日志提交和umount写入超级块
+ *
+ * @return int 链表头块号
+ */
+int newfs_frag_sync() {
+    struct newfs_frag_d* hdr;
+    int i;
+
+    for (i = 0; frag_relink && i < frag_cnt; i++) {
+        hdr = (struct newfs_frag_d*)newfs_bread(frag_dnos[i], FALSE);
+        if (hdr == NULL) {
+            return -NEWFS_ERROR_IO;
+        }
+        hdr->next = i + 1 < frag_cnt ? frag_dnos[i + 1] : NEWFS_NULL_BLK;
+        newfs_bdirty_meta(frag_dnos[i]);
+    }
+    frag_relink = FALSE;
+    return frag_cnt > 0 ? frag_dnos[0] : NEWFS_NULL_BLK;
+}
+
+void newfs_frag_destroy() {
+    free(frag_dnos);
+    free(frag_maps);
+    frag_dnos = NULL;
+    frag_maps = NULL;
+    frag_cnt  = 0;
+    frag_cap  = 0;
+}
+
+/**
+ * @brief 分配len字节的碎片，优先复用未满的碎片块
+ *
+ * @param len
+ * @param ofs 返回碎片在块内的偏移
+ * @return int 碎片块号，失败返回负错误号
+ */
+int newfs_frag_alloc(int len, int* ofs) {
+    struct newfs_frag_d* hdr;
+    int units = NEWFS_ROUND_UP(len, NEWFS_FRAG_SZ()) / NEWFS_FRAG_SZ();
+    int i, unit = -1, dno;
+
+    if (units <= 0 || units >= NEWFS_FRAG_UNITS) {
+        return -NEWFS_ERROR_INVAL;
+    }
+    for (i = 0; i < frag_cnt; i++) {
+        if (newfs_snap_shared(frag_dnos[i])) {              /* 快照仍引用其中的尾部，不再复用 */
+            continue;
+        }
+        unit = newfs_frag_find_run(frag_maps[i], units);
+        if (unit > 0) {
+            break;
+        }
+    }
+    if (unit < 0) {                                     /* 没有可复用的碎片块，新建一个 */
+        dno = newfs_alloc_data();
+        if (dno < 0) {
+            return dno;
+        }
+        hdr = (struct newfs_frag_d*)newfs_bread(dno, TRUE);
+        if (hdr == NULL) {
+            newfs_free_data(dno);
+            return -NEWFS_ERROR_IO;
+        }
+        hdr->magic = NEWFS_FRAG_MAGIC;
+        hdr->next  = NEWFS_NULL_BLK;
+        i = newfs_frag_append(dno, 0x1);
+        if (i < 0) {
+            newfs_free_data(dno);
+            return i;
+        }
+        unit = 1;
+        frag_relink = TRUE;
+    }
+
+    *ofs = unit * NEWFS_FRAG_SZ();
+    frag_maps[i] |= newfs_frag_mask(*ofs, len);
+    hdr = (struct newfs_frag_d*)newfs_bread(frag_dnos[i], FALSE);
+    if (hdr == NULL) {
+        return -NEWFS_ERROR_IO;
+    }
+    hdr->map = frag_maps[i];
+    newfs_bdirty_meta(frag_dnos[i]);
+    return frag_dnos[i];
+}
+
+/**
+ * @brief 释放碎片，碎片块全空时归还数据块
+ *
+ * @param dno
+ * @param ofs
+ * @param len
+ */
+void newfs_frag_free(int dno, int ofs, int len) {
+    struct newfs_frag_d* hdr;
+    int i;
+
+    for (i = 0; i < frag_cnt && frag_dnos[i] != dno; i++);
+    if (i == frag_cnt) {
+        return;
+    }
+    frag_maps[i] &= ~newfs_frag_mask(ofs, len);
+    if (frag_maps[i] == 0x1) {
+        newfs_free_data(dno);
+        frag_cnt--;
+        frag_dnos[i] = frag_dnos[frag_cnt];
+        frag_maps[i] = frag_maps[frag_cnt];
+        frag_relink  = TRUE;
+        return;
+    }
+    hdr = (struct newfs_frag_d*)newfs_bread(dno, FALSE);
+    if (hdr != NULL) {
+        hdr->map = frag_maps[i];
+        newfs_bdirty_meta(dno);
+    }
+}
+
+/**
+ * @brief 把文件不满一块的尾部移入碎片块并释放原数据块，在newfs_sync_inode中调用
+ *
+ * 块缓存至少有两块，相邻两次newfs_bread不会互相淘汰
+ *
+ * @param inode 普通文件
+ * @return int
+ */
+int newfs_frag_pack(struct newfs_inode* inode) {
+    int      blk = inode->size / NEWFS_BLK_SZ();
+    int      len = inode->size % NEWFS_BLK_SZ();
+    int      dno, fdno, ofs;
+    uint8_t* dst;
+    uint8_t* src;
+
+    if (len == 0 || inode->frag_blk != NEWFS_NULL_BLK || blk >= NEWFS_DATA_PER_FILE ||
+        NEWFS_IS_ZIP(inode)) {
+        return NEWFS_ERROR_NONE;
+    }
+    dno = inode->block_pointer[blk];
+    if (dno == NEWFS_NULL_BLK ||
+        NEWFS_ROUND_UP(len, NEWFS_FRAG_SZ()) / NEWFS_FRAG_SZ() >= NEWFS_FRAG_UNITS) {
+        return NEWFS_ERROR_NONE;
+    }
+    fdno = newfs_frag_alloc(len, &ofs);
+    if (fdno < 0) {
+        return fdno == -NEWFS_ERROR_NOSPACE ? NEWFS_ERROR_NONE : fdno;
+    }
+    dst = newfs_bread(fdno, FALSE);
+    src = dst == NULL ? NULL : newfs_bread(dno, FALSE);
+    if (src == NULL) {
+        newfs_frag_free(fdno, ofs, len);
+        return -NEWFS_ERROR_IO;
+    }
+    memcpy(dst + ofs, src, len);
+    newfs_bdirty_meta(fdno);
+    newfs_free_data(dno);
+
+    inode->block_pointer[blk] = NEWFS_NULL_BLK;
+    inode->frag_blk = fdno;
+    inode->frag_ofs = ofs;
+    inode->frag_len = len;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 把碎片中的尾部放回独立的数据块，在改变文件大小或写尾部之前调用
+ *
+ * @param inode 普通文件
+ * @return int
+ */
+int newfs_frag_unpack(struct newfs_inode* inode) {
+    int      blk = inode->size / NEWFS_BLK_SZ();
+    int      dno;
+    uint8_t* src;
+    uint8_t* dst;
+
+    if (inode->frag_blk == NEWFS_NULL_BLK) {
+        return NEWFS_ERROR_NONE;
+    }
+    dno = newfs_alloc_data();
+    if (dno < 0) {
+        return dno;
+    }
+    src = newfs_bread(inode->frag_blk, FALSE);
+    dst = src == NULL ? NULL : newfs_bread(dno, TRUE);
+    if (dst == NULL) {
+        newfs_free_data(dno);
+        return -NEWFS_ERROR_IO;
+    }
+    memcpy(dst, src + inode->frag_ofs, inode->frag_len);
+    newfs_bdirty(dno);
+    newfs_frag_free(inode->frag_blk, inode->frag_ofs, inode->frag_len);
+
+    inode->block_pointer[blk] = dno;
+    inode->frag_blk = NEWFS_NULL_BLK;
+    inode->frag_ofs = 0;
+    inode->frag_len = 0;
+    newfs_inode_dirty_blocks(inode);
+    return NEWFS_ERROR_NONE;
+}
@@ -0,0 +1,379 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+/******************************************************************************
+* SECTION: inode缓存
+* 所有内存inode按最近使用顺序串成LRU链表，总数超过NEWFS_ICACHE_SZ时从最久未用端淘汰。
+* 只淘汰满足以下条件的inode，淘汰后dentry->inode置空，下次访问时重新读入:
+*   - 干净: 自上次同步以来未修改
+*   - 无引用: 没有打开的目录游标等跨调用的引用
+*   - 叶子: 没有已载入inode的子目录项，子目录项的dentry和名字区随目录一起释放
+* 淘汰只在newfs_lookup开始时进行，一次FUSE调用中查找得到的inode在调用结束前都有效，
+* 需要跨调用持有的inode须用newfs_iget/newfs_iput计数。
+* inode另按(快照, ino)挂在哈希表中，与父目录无关: 硬链接的多个dentry共用同一个内存inode，
+* 首个dentry为inode->dentry，其余经dentry->alias串起，每个dentry都计入所在目录的nchild。
+* 脏inode按首次变脏的先后串成链表，同步只遍历该链表，不再从根目录递归整棵树。
+*******************************************************************************/
+static struct newfs_slab   inode_slab = NEWFS_SLAB_INIT("inode", struct newfs_inode);
+static struct newfs_inode* lru_head;                /* 最近使用 */
+static struct newfs_inode* lru_tail;                /* 最久未用 */
+static int                 icache_cnt;
+static struct newfs_inode* ino_hash[NEWFS_ICACHE_HASH];
+static struct newfs_inode* dirty_head;              /* 最早变脏 */
+static struct newfs_inode* dirty_tail;
+static int                 dirty_cnt;
+
+#define NEWFS_ICACHE_BUCKET(ino)   (&ino_hash[(unsigned)(ino) & (NEWFS_ICACHE_HASH - 1)])
+
+static void newfs_icache_unhash(struct newfs_inode* inode) {
+    struct newfs_inode** link = NEWFS_ICACHE_BUCKET(inode->ino);
+
+    while (*link != NULL && *link != inode) {
+        link = &(*link)->hash_next;
+    }
+    if (*link != NULL) {
+        *link = inode->hash_next;
+    }
+    inode->hash_next = NULL;
+}
+
+static void newfs_dirty_append(struct newfs_inode* inode) {
+    inode->dirty_prev = dirty_tail;
+    inode->dirty_next = NULL;
+    if (dirty_tail != NULL) {
+        dirty_tail->dirty_next = inode;
+    }
+    else {
+        dirty_head = inode;
+    }
+    dirty_tail = inode;
+    dirty_cnt++;
+}
+
+/**
+ * @brief 移出脏inode链表并清除脏标记，不在链表中的inode忽略
+ *
+ * @param inode
+ */
+static void newfs_dirty_del(struct newfs_inode* inode) {
+    if (!(inode->flags & (NEWFS_FLAG_INODE_DIRTY | NEWFS_FLAG_INODE_LAZY))) {
+        return;
+    }
+    if (inode->dirty_prev != NULL) {
+        inode->dirty_prev->dirty_next = inode->dirty_next;
+    }
+    else {
+        dirty_head = inode->dirty_next;
+    }
+    if (inode->dirty_next != NULL) {
+        inode->dirty_next->dirty_prev = inode->dirty_prev;
+    }
+    else {
+        dirty_tail = inode->dirty_prev;
+    }
+    inode->dirty_prev = NULL;
+    inode->dirty_next = NULL;
+    dirty_cnt--;
+    inode->flags &= ~(NEWFS_FLAG_INODE_DIRTY | NEWFS_FLAG_INODE_LAZY | NEWFS_FLAG_INODE_BLOCKS);
+}
+
+static void newfs_icache_nchild(struct newfs_dentry* dentry, int delta) {
+    if (dentry->parent != NULL && dentry->parent->inode != NULL) {
+        dentry->parent->inode->nchild += delta;
+    }
+}
+
+static void newfs_icache_unlink(struct newfs_inode* inode) {
+    if (inode->lru_prev != NULL) {
+        inode->lru_prev->lru_next = inode->lru_next;
+    }
+    else {
+        lru_head = inode->lru_next;
+    }
+    if (inode->lru_next != NULL) {
+        inode->lru_next->lru_prev = inode->lru_prev;
+    }
+    else {
+        lru_tail = inode->lru_prev;
+    }
+}
+
+static void newfs_icache_push(struct newfs_inode* inode) {
+    inode->lru_prev = NULL;
+    inode->lru_next = lru_head;
+    if (lru_head != NULL) {
+        lru_head->lru_prev = inode;
+    }
+    lru_head = inode;
+    if (lru_tail == NULL) {
+        lru_tail = inode;
+    }
+}
+
+/**
+ * @brief 释放目录的子目录项、哈希表和名字区
+ *
+ * @param inode 目录，子目录项的inode均未载入
+ */
+static void newfs_icache_free_dentrys(struct newfs_inode* inode) {
+    struct newfs_dentry* dentry;
+
+    while (inode->dentrys != NULL) {
+        dentry         = inode->dentrys;
+        inode->dentrys = dentry->brother;
+        newfs_free_dentry(dentry);
+    }
+    free(inode->dhash);
+    newfs_free_names(inode);
+    inode->dhash    = NULL;
+    inode->dhash_sz = 0;
+}
+
+/**
+ * @brief 从slab中分配一个清零的inode，由newfs_read_inode和newfs_alloc_inode调用
+ *
+ * @return struct newfs_inode* 内存不足返回NULL
+ */
+struct newfs_inode* newfs_icache_alloc() {
+    struct newfs_inode* inode = (struct newfs_inode*)newfs_slab_alloc(&inode_slab);
+    if (inode != NULL) {
+        memset(inode, 0, sizeof(struct newfs_inode));
+    }
+    return inode;
+}
+
+/**
+ * @brief 释放尚未加入缓存的inode(如读入中途出错)，连同已建立的子目录项
+ *
+ * @param inode
+ */
+void newfs_icache_drop(struct newfs_inode* inode) {
+    newfs_icache_free_dentrys(inode);
+    newfs_slab_free(&inode_slab, inode);
+}
+
+/**
+ * @brief 新读入或新分配的inode加入缓存，由newfs_read_inode和newfs_alloc_inode调用
+ *
+ * @param inode 已与dentry互相指向
+ */
+void newfs_icache_add(struct newfs_inode* inode) {
+    struct newfs_inode** bucket = NEWFS_ICACHE_BUCKET(inode->ino);
+
+    inode->ref    = 0;
+    inode->nchild = 0;
+    inode->flags  = 0;
+    inode->dentry->alias = NULL;
+    inode->hash_next = *bucket;
+    *bucket = inode;
+    newfs_icache_push(inode);
+    icache_cnt++;
+    newfs_icache_nchild(inode->dentry, 1);
+}
+
+/**
+ * @brief 按(快照, ino)查找已载入的inode
+ *
+ * @param snap 活动文件系统为NULL
+ * @param ino
+ * @return struct newfs_inode* 未载入返回NULL
+ */
+struct newfs_inode* newfs_icache_find(struct newfs_snap* snap, int ino) {
+    struct newfs_inode* inode = *NEWFS_ICACHE_BUCKET(ino);
+
+    while (inode != NULL && (inode->ino != ino || inode->dentry->snap != snap)) {
+        inode = inode->hash_next;
+    }
+    return inode;
+}
+
+/**
+ * @brief 把又一个指向已载入inode的dentry挂到inode上(硬链接)
+ *
+ * @param inode
+ * @param dentry dentry->inode尚为NULL
+ */
+void newfs_icache_attach(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    dentry->inode        = inode;
+    dentry->alias        = inode->dentry->alias;
+    inode->dentry->alias = dentry;
+    newfs_icache_nchild(dentry, 1);
+}
+
+/**
+ * @brief 把dentry从其inode上摘下，摘下的是首个dentry时由下一个接替
+ *        最后一个dentry摘下后inode->dentry为NULL，调用者须随即释放或移出该inode
+ *
+ * @param dentry
+ */
+void newfs_icache_detach(struct newfs_dentry* dentry) {
+    struct newfs_inode*   inode = dentry->inode;
+    struct newfs_dentry** link  = &inode->dentry;
+
+    while (*link != dentry) {
+        link = &(*link)->alias;
+    }
+    *link = dentry->alias;
+    newfs_icache_nchild(dentry, -1);
+    dentry->alias = NULL;
+    dentry->inode = NULL;
+}
+
+/**
+ * @brief 把已没有dentry的inode移出缓存并释放，不写回
+ *
+ * @param inode 普通文件
+ */
+void newfs_icache_remove(struct newfs_inode* inode) {
+    newfs_dirty_del(inode);
+    newfs_zip_forget(inode);
+    newfs_icache_unhash(inode);
+    newfs_icache_unlink(inode);
+    icache_cnt--;
+    newfs_slab_free(&inode_slab, inode);
+}
+
+/**
+ * @brief 把inode移到最近使用端
+ *
+ * @param inode 不在缓存中的inode(如/.snapshots)忽略
+ */
+void newfs_icache_touch(struct newfs_inode* inode) {
+    if (inode == lru_head || (inode->lru_prev == NULL && inode->lru_next == NULL)) {
+        return;
+    }
+    newfs_icache_unlink(inode);
+    newfs_icache_push(inode);
+}
+
+void newfs_iget(struct newfs_inode* inode) {
+    inode->ref++;
+}
+
+void newfs_iput(struct newfs_inode* inode) {
+    inode->ref--;
+}
+
+/**
+ * @brief 修改内存inode后调用，首次变脏时挂到脏inode链表末尾，同步写回后由newfs_inode_clean清除
+ *
+ * @param inode
+ */
+void newfs_inode_dirty(struct newfs_inode* inode) {
+    if (!(inode->flags & (NEWFS_FLAG_INODE_DIRTY | NEWFS_FLAG_INODE_LAZY))) {
+        newfs_dirty_append(inode);
+    }
+    inode->flags |= NEWFS_FLAG_INODE_DIRTY;
+}
+
+/**
+ * @brief 大小或块指针改变时调用，此后fdatasync不能只写数据块
+ *
+ * @param inode
+ */
+void newfs_inode_dirty_blocks(struct newfs_inode* inode) {
+    newfs_inode_dirty(inode);
+    inode->flags |= NEWFS_FLAG_INODE_BLOCKS;
+}
+
+/**
+ * @brief lazytime下只更新了atime: 随下次同步写回，但不阻止淘汰
+ *
+ * @param inode
+ */
+void newfs_inode_dirty_time(struct newfs_inode* inode) {
+    if (!(inode->flags & (NEWFS_FLAG_INODE_DIRTY | NEWFS_FLAG_INODE_LAZY))) {
+        newfs_dirty_append(inode);
+        inode->flags |= NEWFS_FLAG_INODE_LAZY;
+    }
+}
+
+/**
+ * @brief inode已写回inode表块，移出脏inode链表
+ *
+ * @param inode
+ */
+void newfs_inode_clean(struct newfs_inode* inode) {
+    newfs_dirty_del(inode);
+}
+
+/**
+ * @brief 按首次变脏的先后写回所有脏inode，目录的脏目录项随目录inode一起补写
+ *        某个inode写回失败时继续写其余的，失败的留在链表中
+ *
+ * @return int
+ */
+int newfs_icache_sync() {
+    struct newfs_inode* inode = dirty_head;
+    struct newfs_inode* next;
+    int ret = NEWFS_ERROR_NONE;
+
+    while (inode != NULL) {
+        next = inode->dirty_next;
+        if (newfs_sync_inode(inode) != NEWFS_ERROR_NONE) {
+            ret = -NEWFS_ERROR_IO;
+        }
+        inode = next;
+    }
+    return ret;
+}
+
+/**
+ * @brief 脏inode数，用于决定何时提交日志
+ *
+ * @return int
+ */
+int newfs_icache_dirty_cnt() {
+    return dirty_cnt;
+}
+
+static void newfs_icache_evict(struct newfs_inode* inode) {
+    if (inode->dentrys != NULL) {                   /* 子目录项将被释放，缓存的路径全部作废 */
+        newfs_pcache_flush();
+        newfs_icache_free_dentrys(inode);
+    }
+    while (inode->dentry != NULL) {
+        newfs_icache_detach(inode->dentry);
+    }
+    newfs_icache_remove(inode);
+}
+
+/**
+ * @brief 从最久未用端淘汰可淘汰的inode，直到数量不超过NEWFS_ICACHE_SZ
+ */
+void newfs_icache_shrink() {
+    struct newfs_inode* inode = lru_tail;
+    struct newfs_inode* prev;
+
+    while (icache_cnt > NEWFS_ICACHE_SZ && inode != NULL) {
+        prev = inode->lru_prev;
+        if (inode->ref == 0 && inode->nchild == 0 && !(inode->flags & NEWFS_FLAG_INODE_DIRTY)) {
+            if (!(inode->flags & NEWFS_FLAG_INODE_LAZY) || newfs_sync_inode(inode) == NEWFS_ERROR_NONE) {
+                newfs_icache_evict(inode);
+            }
+        }
+        inode = prev;
+    }
+}
+
+/**
+ * @brief 卸载时释放所有内存inode，须在同步之后调用
+ */
+void newfs_icache_destroy() {
+    struct newfs_inode* inode;
+
+    while (lru_head != NULL) {
+        inode    = lru_head;
+        lru_head = inode->lru_next;
+        free(inode->dhash);
+        newfs_free_names(inode);
+    }
+    lru_tail   = NULL;
+    dirty_head = NULL;
+    dirty_tail = NULL;
+    dirty_cnt  = 0;
+    icache_cnt = 0;
+    memset(ino_hash, 0, sizeof(ino_hash));
+    newfs_slab_destroy(&inode_slab);
+}
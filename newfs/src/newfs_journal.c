@@ -0,0 +1,543 @@
+#include "../include/newfs.h"
+#include <time.h>
+
+extern struct newfs_super      newfs_super;
+
+/******************************************************************************
+* SECTION: 元数据日志
+* 日志区位于数据位图之后，第0块为newfs_journal_d头部，其余各块循环存放事务。
+* 一个事务由描述块和其后的日志块组成，日志块是inode表块、目录块、碎片块、位图块和imap块在提交时的完整副本，
+* 超级块中imap的位置、快照数、快照表位置和碎片块链表头变化时，超级块映像也一并记入日志。
+* 描述块记录各日志块的目标块号和整个事务的校验和，事务一次顺序写入，校验不符即视为未提交。
+* 组提交: 操作只修改缓存，newfs_lookup开始时(上一个操作已经完整)和后台提交线程定时检查，距上次提交超过
+* NEWFS_JOURNAL_INTERVAL秒、或未提交的块接近单个事务的容量时，期间所有操作合成一个事务。
+* 有序模式: 写入事务之前先把缓存中不属于本事务的脏块(文件数据和已提交的元数据)写回原位，
+* 重放出的inode不会指向尚未写入的数据块。
+* 检查点是惰性的: 已提交的块作为普通脏块随淘汰、下一次提交或flush原地写回，日志剩余空间不足一个事务时
+* 才写回位图、imap和超级块并清空日志。挂载时重放tail之后所有校验通过的事务。
+* 已记入日志的块被释放后，在下一个事务中撤销，重放时不再用更早的副本覆盖它。
+*******************************************************************************/
+static int        j_blks;
+static int        j_head;                   /* 下一个事务写入的位置，[1, j_blks) */
+static int        j_tail;                   /* 最早一个未检查点的事务 */
+static uint32_t   j_seq;                    /* 下一个事务的序号 */
+static uint32_t   j_tail_seq;
+static int        j_cap;                    /* 单个事务最多的日志块数 */
+static int        j_room;                   /* 扣除位图、imap和超级块后，单个事务可容纳的元数据块数 */
+static uint8_t*   j_buf;                    /* 描述块 + j_cap个日志块 */
+static int*       j_dnos;
+static uint8_t**  j_datas;
+static uint8_t*   j_map_inode;              /* 最近一次提交时的位图 */
+static uint8_t*   j_map_data;
+static uint8_t*   j_imap;                   /* 最近一次提交时的imap，按块补齐 */
+static uint8_t*   j_imap_cur;
+static int        j_imap_blks;
+static int        j_imap_dno;               /* j_imap所在数据块 */
+static uint8_t*   j_super;                  /* 最近一次提交时的超级块映像 */
+static uint8_t*   j_super_cur;              /* 本次提交的超级块映像 */
+static boolean    j_imap_dirty;             /* 检查点以来imap被记入日志 */
+static boolean    j_super_dirty;
+static int*       j_logged;                 /* 检查点以来记入日志的块号 */
+static int        j_logged_cnt;
+static int*       j_revoke;                 /* 本事务撤销的块号 */
+static int        j_revoke_cnt;
+static time_t     j_last;                   /* 上次提交的时间 */
+
+static inline time_t newfs_journal_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+static inline int newfs_journal_used() {
+    return (j_head - j_tail + j_blks - 1) % (j_blks - 1);
+}
+
+/**
+ * @brief 从日志区的第idx块起连续读写n块，越过末尾时从第1块继续
+ *
+ * @return int
+ */
+static int newfs_journal_io(int idx, uint8_t* buf, int n, boolean is_write) {
+    int len, ret, ofs;
+
+    while (n > 0) {
+        len = j_blks - idx < n ? j_blks - idx : n;
+        ofs = newfs_super.journal_offset + NEWFS_BLKS_SZ(idx);
+        ret = is_write ? newfs_driver_write(ofs, buf, NEWFS_BLKS_SZ(len)) :
+                         newfs_driver_read(ofs, buf, NEWFS_BLKS_SZ(len));
+        if (ret != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+        buf += NEWFS_BLKS_SZ(len);
+        n   -= len;
+        idx  = 1;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+static int newfs_journal_write_head() {
+    struct newfs_journal_d head;
+
+    head.magic = NEWFS_JOURNAL_MAGIC;
+    head.seq   = j_tail_seq;
+    head.tail  = j_tail;
+    return newfs_driver_write(newfs_super.journal_offset, (uint8_t*)&head, sizeof(head));
+}
+
+/**
+ * @brief 事务的校验和，计算时描述块中的checksum视为0
+ */
+static uint32_t newfs_journal_csum(uint8_t* tx, int nr) {
+    struct newfs_jdesc_d* desc = (struct newfs_jdesc_d*)tx;
+    uint32_t saved = desc->checksum;
+    uint32_t csum;
+
+    desc->checksum = 0;
+    csum = newfs_name_hash((const char*)tx, NEWFS_BLKS_SZ(1 + nr));
+    desc->checksum = saved;
+    return csum;
+}
+
+/**
+ * @brief 挂载时重放日志: 按序号依次校验tail之后的事务，校验通过的写回原位置，然后清空日志
+ *        须在读入位图和初始化块缓存之前调用
+ *
+ * @param newfs_super_d 已读入的超级块，重放改写超级块时重新读入
+ * @return int 重放的事务数
+ */
+int newfs_journal_replay(struct newfs_super_d* newfs_super_d) {
+    struct newfs_journal_d head;
+    struct newfs_jdesc_d*  desc;
+    uint8_t*  region;
+    uint8_t*  tx;
+    int*      starts;
+    int*      rblk;
+    uint32_t* rseq;
+    int       rcnt = 0, cnt = 0, scanned = 0;
+    int       idx, nr, i, k, r, blk, total_blks;
+    uint32_t  seq;
+    boolean   is_revoked;
+
+    newfs_super.sz_blks        = newfs_super_d->sz_blks;
+    newfs_super.journal_offset = newfs_super_d->journal_offset;
+    newfs_super.journal_blks   = newfs_super_d->journal_blks;
+    j_blks = newfs_super.journal_blks;
+    if (newfs_driver_read(newfs_super.journal_offset, (uint8_t*)&head, sizeof(head)) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (head.magic != NEWFS_JOURNAL_MAGIC || head.tail < 1 || head.tail >= j_blks) {
+        return 0;
+    }
+    total_blks = NEWFS_DISK_SZ() / NEWFS_BLK_SZ();
+    region = (uint8_t*)malloc(NEWFS_BLKS_SZ(j_blks));
+    tx     = (uint8_t*)malloc(NEWFS_BLKS_SZ(j_blks));
+    starts = (int*)malloc(j_blks * sizeof(int));
+    rblk   = (int*)malloc(j_blks * NEWFS_JDESC_MAX() * sizeof(int));
+    rseq   = (uint32_t*)malloc(j_blks * NEWFS_JDESC_MAX() * sizeof(uint32_t));
+    if (region == NULL || tx == NULL || starts == NULL || rblk == NULL || rseq == NULL ||
+        newfs_driver_read(newfs_super.journal_offset, region, NEWFS_BLKS_SZ(j_blks)) != NEWFS_ERROR_NONE) {
+        free(region); free(tx); free(starts); free(rblk); free(rseq);
+        return -NEWFS_ERROR_IO;
+    }
+
+    /* 第一遍: 找出所有完整的事务，收集撤销表 */
+    idx = head.tail;
+    seq = head.seq;
+    while (TRUE) {
+        desc = (struct newfs_jdesc_d*)(region + NEWFS_BLKS_SZ(idx));
+        nr   = desc->nr;
+        if (desc->magic != NEWFS_JDESC_MAGIC || desc->seq != seq || nr < 0 || desc->nrevoke < 0 ||
+            nr + desc->nrevoke > NEWFS_JDESC_MAX() || scanned + 1 + nr >= j_blks - 1) {
+            break;
+        }
+        for (i = 0; i <= nr; i++) {
+            memcpy(tx + NEWFS_BLKS_SZ(i), region + NEWFS_BLKS_SZ((idx - 1 + i) % (j_blks - 1) + 1),
+                   NEWFS_BLK_SZ());
+        }
+        if (newfs_journal_csum(tx, nr) != desc->checksum) {
+            break;                                          /* 写到一半的事务 */
+        }
+        desc = (struct newfs_jdesc_d*)tx;
+        for (i = 0; i < desc->nrevoke; i++) {
+            rblk[rcnt] = desc->target[nr + i];
+            rseq[rcnt] = seq;
+            rcnt++;
+        }
+        starts[cnt++] = idx;
+        scanned += 1 + nr;
+        idx = (idx - 1 + 1 + nr) % (j_blks - 1) + 1;
+        seq++;
+    }
+
+    /* 第二遍: 按提交顺序写回，被之后的事务撤销的块跳过 */
+    for (k = 0; k < cnt; k++) {
+        desc = (struct newfs_jdesc_d*)(region + NEWFS_BLKS_SZ(starts[k]));
+        nr   = desc->nr;
+        for (i = 1; i <= nr; i++) {
+            blk = desc->target[i - 1];
+            if (blk < 0 || blk >= total_blks || (NEWFS_BLKS_SZ(blk) >= newfs_super.journal_offset &&
+                NEWFS_BLKS_SZ(blk) < newfs_super.journal_offset + NEWFS_BLKS_SZ(j_blks))) {
+                continue;
+            }
+            is_revoked = FALSE;
+            for (r = 0; r < rcnt && !is_revoked; r++) {
+                is_revoked = rblk[r] == blk && rseq[r] > desc->seq;
+            }
+            if (is_revoked) {
+                continue;
+            }
+            if (newfs_driver_write(NEWFS_BLKS_SZ(blk),
+                                   region + NEWFS_BLKS_SZ((starts[k] - 1 + i) % (j_blks - 1) + 1),
+                                   NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+                free(region); free(tx); free(starts); free(rblk); free(rseq);
+                return -NEWFS_ERROR_IO;
+            }
+        }
+    }
+    free(region); free(tx); free(starts); free(rblk); free(rseq);
+    j_tail     = idx;
+    j_tail_seq = seq + 1;                                   /* 跳过idx处可能残留的半个事务的序号 */
+    if (newfs_journal_write_head() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (cnt > 0) {
+        NEWFS_DBG("[%s] replayed %d transactions\n", __func__, cnt);
+        if (newfs_driver_read(NEWFS_SUPER_OFS, (uint8_t*)newfs_super_d,
+                              sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    return cnt;
+}
+
+/**
+ * @brief 挂载时初始化日志，须在载入位图和imap之后调用；日志区过小时不启用
+ *
+ * @param nbufs 块缓存的块数，未提交的元数据块不能超过其一半
+ * @param newfs_super_d 磁盘上的超级块，作为日志中超级块映像的底本
+ * @return int
+ */
+int newfs_journal_init(int nbufs, struct newfs_super_d* newfs_super_d) {
+    struct newfs_journal_d head;
+
+    newfs_super.is_journal = FALSE;
+    if (!(newfs_super.features & NEWFS_FEATURE_JOURNAL)) {
+        return NEWFS_ERROR_NONE;
+    }
+    j_blks      = newfs_super.journal_blks;
+    j_imap_blks = NEWFS_ROUND_UP(newfs_super.inode_blks * (int)sizeof(int), NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
+    j_cap  = NEWFS_JDESC_MAX() / 2;
+    j_cap  = j_cap < (j_blks - 1) / 2 - 1 ? j_cap : (j_blks - 1) / 2 - 1;
+    j_cap  = j_cap < nbufs / 2 ? j_cap : nbufs / 2;
+    j_room = j_cap - newfs_super.map_inode_blks - newfs_super.map_data_blks - j_imap_blks - 1;
+    if (j_room < 2) {
+        NEWFS_DBG("[%s] journal too small, disabled\n", __func__);
+        return NEWFS_ERROR_NONE;
+    }
+
+    j_buf       = (uint8_t*)malloc(NEWFS_BLKS_SZ(1 + j_cap));
+    j_dnos      = (int*)malloc(j_cap * sizeof(int));
+    j_datas     = (uint8_t**)malloc(j_cap * sizeof(uint8_t*));
+    j_map_inode = (uint8_t*)malloc(NEWFS_BLKS_SZ(newfs_super.map_inode_blks));
+    j_map_data  = (uint8_t*)malloc(NEWFS_BLKS_SZ(newfs_super.map_data_blks));
+    j_imap      = (uint8_t*)calloc(j_imap_blks, NEWFS_BLK_SZ());
+    j_imap_cur  = (uint8_t*)calloc(j_imap_blks, NEWFS_BLK_SZ());
+    j_super     = (uint8_t*)calloc(1, NEWFS_BLK_SZ());
+    j_super_cur = (uint8_t*)calloc(1, NEWFS_BLK_SZ());
+    j_logged    = (int*)malloc(j_blks * sizeof(int));
+    j_revoke    = (int*)malloc(j_blks * sizeof(int));
+    if (j_buf == NULL || j_dnos == NULL || j_datas == NULL || j_map_inode == NULL || j_map_data == NULL ||
+        j_imap == NULL || j_imap_cur == NULL || j_super == NULL || j_super_cur == NULL ||
+        j_logged == NULL || j_revoke == NULL) {
+        newfs_journal_destroy();
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    memcpy(j_map_inode, newfs_super.map_inode, NEWFS_BLKS_SZ(newfs_super.map_inode_blks));
+    memcpy(j_map_data, newfs_super.map_data, NEWFS_BLKS_SZ(newfs_super.map_data_blks));
+    memcpy(j_imap, newfs_super.imap, newfs_super.inode_blks * sizeof(int));
+    memcpy(j_super, newfs_super_d, sizeof(struct newfs_super_d));
+    j_imap_dno    = newfs_super_d->imap_dno;
+    j_imap_dirty  = FALSE;
+    j_super_dirty = FALSE;
+    j_logged_cnt  = 0;
+    j_revoke_cnt  = 0;
+
+    if (newfs_driver_read(newfs_super.journal_offset, (uint8_t*)&head, sizeof(head)) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (head.magic == NEWFS_JOURNAL_MAGIC && head.tail >= 1 && head.tail < j_blks) {
+        j_tail     = head.tail;                             /* 重放后日志为空 */
+        j_tail_seq = head.seq;
+    }
+    else {                                                  /* 新格式化: 序号随机起步，区中残留的旧事务不会被误认 */
+        j_tail     = 1;
+        j_tail_seq = (uint32_t)time(NULL);
+        if (newfs_journal_write_head() != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    j_head = j_tail;
+    j_seq  = j_tail_seq;
+    j_last = newfs_journal_now();
+    newfs_super.is_journal = TRUE;
+    return NEWFS_ERROR_NONE;
+}
+
+void newfs_journal_destroy() {
+    free(j_buf);
+    free(j_dnos);
+    free(j_datas);
+    free(j_map_inode);
+    free(j_map_data);
+    free(j_imap);
+    free(j_imap_cur);
+    free(j_super);
+    free(j_super_cur);
+    free(j_logged);
+    free(j_revoke);
+    j_buf       = NULL;
+    j_dnos      = NULL;
+    j_datas     = NULL;
+    j_map_inode = NULL;
+    j_map_data  = NULL;
+    j_imap      = NULL;
+    j_imap_cur  = NULL;
+    j_super     = NULL;
+    j_super_cur = NULL;
+    j_logged    = NULL;
+    j_revoke    = NULL;
+    newfs_super.is_journal = FALSE;
+}
+
+/**
+ * @brief 已提交的内容全部原地写回后清空日志
+ *
+ * @return int
+ */
+static int newfs_journal_reset() {
+    if (newfs_bflush() != NEWFS_ERROR_NONE ||
+        newfs_driver_write(newfs_super.map_inode_offset, j_map_inode,
+                           NEWFS_BLKS_SZ(newfs_super.map_inode_blks)) != NEWFS_ERROR_NONE ||
+        newfs_driver_write(newfs_super.map_data_offset, j_map_data,
+                           NEWFS_BLKS_SZ(newfs_super.map_data_blks)) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (j_imap_dirty && newfs_driver_write(NEWFS_DATA_OFS(j_imap_dno), j_imap,
+                                           NEWFS_BLKS_SZ(j_imap_blks)) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (j_super_dirty && newfs_driver_write(NEWFS_SUPER_OFS, j_super,
+                                            sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    j_imap_dirty  = FALSE;
+    j_super_dirty = FALSE;
+    j_tail        = j_head;
+    j_tail_seq    = j_seq;
+    j_logged_cnt  = 0;
+    j_revoke_cnt  = 0;
+    return newfs_journal_write_head();
+}
+
+/**
+ * @brief 事务已落盘(或已决定原地写回)，以当前的位图和imap作为下一次提交比较的基准
+ *
+ * @param imap_dno 活动imap所在数据块
+ */
+static void newfs_journal_shadow(int imap_dno) {
+    memcpy(j_map_inode, newfs_super.map_inode, NEWFS_BLKS_SZ(newfs_super.map_inode_blks));
+    memcpy(j_map_data, newfs_super.map_data, NEWFS_BLKS_SZ(newfs_super.map_data_blks));
+    if (imap_dno != NEWFS_NULL_BLK &&
+        (imap_dno != j_imap_dno || memcmp(j_imap, j_imap_cur, NEWFS_BLKS_SZ(j_imap_blks)) != 0)) {
+        j_imap_dirty = TRUE;
+    }
+    if (memcmp(j_super_cur, j_super, sizeof(struct newfs_super_d)) != 0) {
+        memcpy(j_super, j_super_cur, sizeof(struct newfs_super_d));
+        j_super_dirty = TRUE;
+    }
+    j_imap_dno = imap_dno;
+    memcpy(j_imap, j_imap_cur, NEWFS_BLKS_SZ(j_imap_blks));
+}
+
+/**
+ * @brief 修改量超出单个事务的容量时退化为原地写回
+ *
+ * 先在本事务的块仍为未提交元数据、不会被写回时对已有的日志做检查点并清空日志，
+ * 再原地写回本事务: 崩溃在前一步时重放的仍是已提交的内容，在后一步时日志已空，不会用旧副本覆盖新内容
+ *
+ * @return int
+ */
+static int newfs_journal_overflow(int imap_dno) {
+    NEWFS_DBG("[%s] transaction exceeds journal capacity, writing in place\n", __func__);
+    if (newfs_journal_reset() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_bmeta_commit();
+    newfs_journal_shadow(imap_dno);
+    return newfs_journal_reset();
+}
+
+/**
+ * @brief 把自上次提交以来变化的块加入事务
+ *
+ * @param blk 第一块的磁盘块号
+ * @param is_all 不比较，全部加入
+ * @return int 加入后的日志块数，超出容量返回-1
+ */
+static int newfs_journal_add_blks(uint8_t* cur, uint8_t* shadow, int blks, int blk, boolean is_all, int nr) {
+    struct newfs_jdesc_d* desc = (struct newfs_jdesc_d*)j_buf;
+
+    for (int i = 0; i < blks; i++) {
+        if (!is_all && memcmp(cur + NEWFS_BLKS_SZ(i), shadow + NEWFS_BLKS_SZ(i), NEWFS_BLK_SZ()) == 0) {
+            continue;
+        }
+        if (nr == j_cap) {
+            return -1;
+        }
+        desc->target[nr] = blk + i;
+        memcpy(j_buf + NEWFS_BLKS_SZ(1 + nr), cur + NEWFS_BLKS_SZ(i), NEWFS_BLK_SZ());
+        nr++;
+    }
+    return nr;
+}
+
+/**
+ * @brief 提交事务: 写回脏inode到inode表块，把所有未提交的元数据块和变化的位图、imap块
+ *        作为一个事务顺序写入日志
+ *
+ * @return int
+ */
+int newfs_journal_commit() {
+    struct newfs_jdesc_d* desc = (struct newfs_jdesc_d*)j_buf;
+    int nr, n, i, imap_dno, frag_head;
+
+    if (!newfs_super.is_journal) {
+        return NEWFS_ERROR_NONE;
+    }
+    if (newfs_icache_sync() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    frag_head = newfs_frag_sync();                      /* 打包尾部可能改变碎片块集合 */
+    if (frag_head < NEWFS_NULL_BLK) {
+        return -NEWFS_ERROR_IO;
+    }
+    j_last   = newfs_journal_now();
+    imap_dno = newfs_snap_imap_dno();
+    memcpy(j_imap_cur, newfs_super.imap, newfs_super.inode_blks * sizeof(int));
+    memcpy(j_super_cur, j_super, NEWFS_BLK_SZ());
+    newfs_snap_super((struct newfs_super_d*)j_super_cur);
+    ((struct newfs_super_d*)j_super_cur)->frag_head = frag_head;
+
+    nr = newfs_journal_add_blks(newfs_super.map_inode, j_map_inode, newfs_super.map_inode_blks,
+                                newfs_super.map_inode_offset / NEWFS_BLK_SZ(), FALSE, 0);
+    if (nr >= 0) {
+        nr = newfs_journal_add_blks(newfs_super.map_data, j_map_data, newfs_super.map_data_blks,
+                                    newfs_super.map_data_offset / NEWFS_BLK_SZ(), FALSE, nr);
+    }
+    if (nr >= 0 && imap_dno != NEWFS_NULL_BLK) {        /* imap刚分配时其所在块尚无内容，整段记入 */
+        nr = newfs_journal_add_blks(j_imap_cur, j_imap, j_imap_blks, NEWFS_DATA_OFS(imap_dno) / NEWFS_BLK_SZ(),
+                                    imap_dno != j_imap_dno, nr);
+    }
+    if (nr >= 0) {                                      /* imap的位置、快照表和碎片链表头记在超级块中 */
+        nr = newfs_journal_add_blks(j_super_cur, j_super, 1, NEWFS_SUPER_OFS / NEWFS_BLK_SZ(), FALSE, nr);
+    }
+    n = nr < 0 ? -1 : newfs_bmeta_collect(j_dnos, j_datas, j_cap - nr);
+    if (n < 0 || nr + n + j_revoke_cnt > NEWFS_JDESC_MAX() ||
+        newfs_journal_used() + 1 + nr + n >= j_blks - 1) {
+        return newfs_journal_overflow(imap_dno);
+    }
+    for (i = 0; i < n; i++, nr++) {
+        desc->target[nr] = NEWFS_DATA_OFS(j_dnos[i]) / NEWFS_BLK_SZ();
+        memcpy(j_buf + NEWFS_BLKS_SZ(1 + nr), j_datas[i], NEWFS_BLK_SZ());
+    }
+    if (nr == 0 && j_revoke_cnt == 0) {
+        return NEWFS_ERROR_NONE;
+    }
+
+    desc->magic    = NEWFS_JDESC_MAGIC;
+    desc->seq      = j_seq;
+    desc->nr       = nr;
+    desc->nrevoke  = j_revoke_cnt;
+    memcpy(&desc->target[nr], j_revoke, j_revoke_cnt * sizeof(int));
+    memset(&desc->target[nr + j_revoke_cnt], 0,
+           (NEWFS_JDESC_MAX() - nr - j_revoke_cnt) * sizeof(int));
+    desc->checksum = newfs_journal_csum(j_buf, nr);
+    if (newfs_bflush() != NEWFS_ERROR_NONE ||               /* 有序模式: 数据先于引用它的元数据落盘 */
+        newfs_journal_io(j_head, j_buf, 1 + nr, TRUE) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+
+    /* 已落入日志: 元数据块可以原地写回了 */
+    j_head = (j_head - 1 + 1 + nr) % (j_blks - 1) + 1;
+    j_seq++;
+    newfs_bmeta_commit();
+    newfs_journal_shadow(imap_dno);
+    for (i = 0; i < nr && j_logged_cnt < j_blks; i++) {
+        j_logged[j_logged_cnt++] = desc->target[i];
+    }
+    j_revoke_cnt = 0;
+
+    if (j_blks - 1 - newfs_journal_used() <= j_cap + 1) {  /* 放不下下一个事务，集中写回 */
+        return newfs_journal_reset();
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 检查点: 提交当前事务，把日志中的内容全部原地写回并清空日志
+ *
+ * @return int
+ */
+int newfs_journal_checkpoint() {
+    if (!newfs_super.is_journal) {
+        return NEWFS_ERROR_NONE;
+    }
+    if (newfs_journal_commit() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (j_head == j_tail) {                                 /* 日志为空，已提交的内容都已写回 */
+        return newfs_bflush();
+    }
+    return newfs_journal_reset();
+}
+
+/**
+ * @brief 组提交的时机: 每个操作开始时和提交线程定时调用，超时或未提交的修改接近单个事务的容量时提交
+ */
+void newfs_journal_tick() {
+    if (!newfs_super.is_journal) {
+        return;
+    }
+    if (newfs_bmeta_cnt() + newfs_icache_dirty_cnt() >= j_room / 2 ||
+        newfs_journal_now() - j_last >= NEWFS_JOURNAL_INTERVAL) {
+        if (newfs_journal_commit() != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] commit failed\n", __func__);
+        }
+    }
+}
+
+/**
+ * @brief 数据块被释放: 若它在日志中还有旧副本，在下一个事务中撤销
+ *
+ * @param dno
+ */
+void newfs_journal_revoke(int dno) {
+    int blk = NEWFS_DATA_OFS(dno) / NEWFS_BLK_SZ();
+    int i;
+
+    if (!newfs_super.is_journal) {
+        return;
+    }
+    for (i = 0; i < j_revoke_cnt; i++) {
+        if (j_revoke[i] == blk) {
+            return;
+        }
+    }
+    for (i = 0; i < j_logged_cnt; i++) {
+        if (j_logged[i] == blk) {
+            j_revoke[j_revoke_cnt++] = blk;
+            return;
+        }
+    }
+}
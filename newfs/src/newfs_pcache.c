@@ -0,0 +1,122 @@
+#include "../include/newfs.h"
+
+/******************************************************************************
+* SECTION: 路径缓存
+* FUSE高层接口的每个回调都传入完整路径，路径缓存把路径直接映射到dentry，
+* 命中时不必从根目录逐级查找。缓存是直接映射的表，冲突时覆盖旧项。
+* 不存在的路径也缓存为否定项，记录查找止步的目录，命中时直接返回该目录，不再逐级查找，
+* 也覆盖内核dcache之外的查找(如mknod/mkdir前对新路径的查找)。
+* 失效依靠代数而不是逐项清除:
+*   - 目录删除子项时目录的gen加一，缓存项所记目录的gen变化即失效
+*   - 目录新增子项时目录项数变化，否定项失效；肯定项不受新增影响
+*   - 删除的是子目录时其下所有路径都失效，此时全局代数加一
+* 淘汰目录inode时其子目录项被释放，此时也加一全局代数。
+* 全局代数未变时目录的dentry一定还在，缓存项只经dir访问目录，不读可能已释放的文件dentry。
+*******************************************************************************/
+static struct newfs_path_ent* path_table;
+static uint32_t               path_gen;             /* 全局代数 */
+
+int newfs_pcache_init() {
+    path_gen   = 0;
+    path_table = (struct newfs_path_ent*)calloc(NEWFS_PCACHE_SZ, sizeof(struct newfs_path_ent));
+    return path_table == NULL ? -NEWFS_ERROR_NOSPACE : NEWFS_ERROR_NONE;
+}
+
+void newfs_pcache_destroy() {
+    int i;
+
+    for (i = 0; path_table != NULL && i < NEWFS_PCACHE_SZ; i++) {
+        free(path_table[i].path);
+    }
+    free(path_table);
+    path_table = NULL;
+}
+
+/**
+ * @brief 按完整路径查找缓存的dentry
+ *
+ * @param path
+ * @param len
+ * @param is_find 返回是否为肯定项
+ * @return struct newfs_dentry* 未命中或已失效返回NULL；否定项返回查找止步的目录
+ */
+struct newfs_dentry* newfs_pcache_find(const char* path, int len, boolean* is_find) {
+    struct newfs_path_ent* ent;
+    struct newfs_inode*    dir;
+    uint32_t               hash;
+
+    if (path_table == NULL) {
+        return NULL;
+    }
+    hash = newfs_name_hash(path, len);
+    ent  = &path_table[hash & (NEWFS_PCACHE_SZ - 1)];
+    if (ent->dentry == NULL || ent->hash != hash || ent->len != len || ent->gen != path_gen) {
+        return NULL;
+    }
+    dir = ent->dir->inode;                              /* 全局代数未变，目录一定还在 */
+    if (dir == NULL || dir->gen != ent->dir_gen || (!ent->is_find && dir->dir_cnt != ent->dir_cnt) ||
+        memcmp(ent->path, path, len) != 0) {
+        return NULL;
+    }
+    *is_find = ent->is_find;
+    return ent->dentry;
+}
+
+/**
+ * @brief 缓存路径到dentry的映射
+ *
+ * @param path
+ * @param len
+ * @param dentry 肯定项为找到的dentry(不能是根目录，父目录须已在内存中)，否定项为查找止步的目录
+ * @param is_find
+ */
+void newfs_pcache_add(const char* path, int len, struct newfs_dentry* dentry, boolean is_find) {
+    struct newfs_path_ent* ent;
+    struct newfs_dentry*   dir = is_find ? dentry->parent : dentry;
+    uint32_t               hash;
+    char*                  buf;
+
+    if (path_table == NULL || dir == NULL || dir->inode == NULL) {
+        return;
+    }
+    hash = newfs_name_hash(path, len);
+    ent  = &path_table[hash & (NEWFS_PCACHE_SZ - 1)];
+    if (ent->cap < len) {
+        buf = (char*)realloc(ent->path, len);
+        if (buf == NULL) {
+            ent->dentry = NULL;
+            return;
+        }
+        ent->path = buf;
+        ent->cap  = len;
+    }
+    memcpy(ent->path, path, len);
+    ent->hash    = hash;
+    ent->len     = len;
+    ent->gen     = path_gen;
+    ent->dir_gen = dir->inode->gen;
+    ent->dir_cnt = dir->inode->dir_cnt;
+    ent->is_find = is_find;
+    ent->dir     = dir;
+    ent->dentry  = dentry;
+}
+
+/**
+ * @brief 目录删除子项时调用，使经过该子项的缓存路径失效
+ *
+ * @param dir 父目录
+ * @param dentry 被删除的子项
+ */
+void newfs_pcache_inval(struct newfs_inode* dir, struct newfs_dentry* dentry) {
+    dir->gen++;
+    if (dentry->ftype == NEWFS_DIR) {
+        path_gen++;
+    }
+}
+
+/**
+ * @brief 使所有缓存的路径失效，在内存目录项被整体释放(inode淘汰)时调用
+ */
+void newfs_pcache_flush() {
+    path_gen++;
+}
@@ -0,0 +1,74 @@
+#include "../include/newfs.h"
+
+/******************************************************************************
+* SECTION: slab分配器
+* 同一种内存对象(如dentry)每次向系统申请NEWFS_SLAB_CHUNK_SZ大小的一块，切成等长对象，
+* 释放的对象挂在空闲链表上复用。同一目录下依次读入的目录项在内存中相邻，
+* 也省去了逐个malloc的头部开销。大块只在newfs_slab_destroy时整体归还。
+* 每个slab统计存活对象数和大块数，调试时可据此观察元数据的内存占用。
+* main以单线程模式(-s)运行FUSE，回调串行访问内存结构，slab不加锁，也不设每线程的空闲链表。
+*******************************************************************************/
+
+/**
+ * @brief 从slab中分配一个对象，内容未初始化
+ *
+ * @param slab obj_sz须已设置
+ * @return void* 内存不足返回NULL
+ */
+void* newfs_slab_alloc(struct newfs_slab* slab) {
+    size_t   obj_sz = NEWFS_ROUND_UP(slab->obj_sz, sizeof(void*));
+    uint8_t* chunk;
+    uint8_t* obj;
+    void*    ret;
+
+    if (slab->free == NULL) {
+        chunk = (uint8_t*)malloc(NEWFS_SLAB_CHUNK_SZ);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        *(void**)chunk = slab->chunks;                      /* 大块首部链接所有大块 */
+        slab->chunks   = chunk;
+        slab->nchunks++;
+        for (obj = chunk + sizeof(void*); obj + obj_sz <= chunk + NEWFS_SLAB_CHUNK_SZ; obj += obj_sz) {
+            *(void**)obj = slab->free;
+            slab->free   = obj;
+        }
+    }
+    ret = slab->free;
+    slab->free = *(void**)ret;
+    slab->live++;
+    return ret;
+}
+
+/**
+ * @brief 把对象放回slab的空闲链表
+ *
+ * @param slab
+ * @param obj
+ */
+void newfs_slab_free(struct newfs_slab* slab, void* obj) {
+    if (obj == NULL) {
+        return;
+    }
+    *(void**)obj = slab->free;
+    slab->free   = obj;
+    slab->live--;
+}
+
+/**
+ * @brief 归还slab的所有大块，之前分配的对象全部失效
+ *
+ * @param slab
+ */
+void newfs_slab_destroy(struct newfs_slab* slab) {
+    void* chunk;
+
+    while (slab->chunks != NULL) {
+        chunk        = slab->chunks;
+        slab->chunks = *(void**)chunk;
+        free(chunk);
+    }
+    slab->free    = NULL;
+    slab->live    = 0;
+    slab->nchunks = 0;
+}
@@ -0,0 +1,537 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+/******************************************************************************
+* SECTION: 快照
+* 快照冻结创建时刻的inode表映射(imap)和数据位图，二者各占一段连续数据块，
+* 创建的代价只与这两者的大小有关，与磁盘上的数据量无关。
+* 之后活动文件系统改写最新快照也引用的块时写时复制:
+*   - 数据块: 在最新快照的数据位图中置位即视为共享，写前复制，释放时保留
+*   - inode表块: imap项与最新快照相同即视为共享，同步时复制到新数据块并修改imap
+* imap同时记录inode区之外按需分配的inode表块，没有快照时只要扩展过也需写回。
+* 创建时只把脏inode写进缓存中的inode表块，不刷写块缓存: 缓存中的脏块在写时复制前内容不变，
+* 之后随淘汰或flush写回原位置，正是快照看到的内容。
+* 快照挂在隐藏目录/.snapshots/<name>下只读访问，目前不支持删除快照，
+* 快照引用的块不会被活动文件系统释放，其占用的空间一直保留。
+* mkdir返回前快照已经持久: 启用日志时快照表经块缓存作为元数据，快照数和快照表位置随超级块映像
+* 立即提交一个事务；不启用日志时同步写回缓存、快照表、imap、位图和超级块。
+* 不启用日志时imap在卸载时写回，fsync只把单个inode表块的映射补写到磁盘上的imap中。
+*******************************************************************************/
+static struct newfs_snap  snaps[NEWFS_MAX_SNAPS];
+static int                snap_cnt;
+static int                snap_blk;                 /* 快照表所在数据块 */
+static int                imap_dno;                 /* 活动imap所在数据块 */
+static int*               imap_disk;                /* 磁盘上的活动imap */
+static int                imap_disk_dno;            /* 磁盘超级块中记录的imap_dno */
+static struct newfs_inode snap_inode;               /* /.snapshots的内存inode */
+
+static inline int newfs_snap_imap_blks() {
+    return NEWFS_ROUND_UP(newfs_super.inode_blks * (int)sizeof(int), NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
+}
+
+static inline int newfs_snap_map_sz() {
+    return NEWFS_BLKS_SZ(newfs_super.map_data_blks);
+}
+
+static inline struct newfs_snap* newfs_snap_latest() {
+    return snap_cnt > 0 ? &snaps[snap_cnt - 1] : NULL;
+}
+
+/**
+ * @brief 分配n个连续的数据块
+ *
+ * @return int 第一个数据块号，失败返回-NEWFS_ERROR_NOSPACE
+ */
+static int newfs_snap_alloc_run(int n) {
+    int dno, i, len = 0;
+
+    for (dno = 0; dno < newfs_super.max_data; dno++) {
+        if (newfs_super.map_data[dno / UINT8_BITS] & (0x1 << (dno % UINT8_BITS))) {
+            len = 0;
+            continue;
+        }
+        if (++len == n) {
+            for (i = dno - n + 1; i <= dno; i++) {
+                newfs_super.map_data[i / UINT8_BITS] |= (0x1 << (i % UINT8_BITS));
+            }
+            return dno - n + 1;
+        }
+    }
+    return -NEWFS_ERROR_NOSPACE;
+}
+
+static void newfs_snap_free_run(int dno, int n) {
+    for (; n > 0; n--, dno++) {
+        newfs_super.map_data[dno / UINT8_BITS] &= (uint8_t)(~(0x1 << (dno % UINT8_BITS)));
+    }
+}
+
+/**
+ * @brief 在/.snapshots下为快照建立根目录项，根inode按需经快照的imap读取
+ *
+ * @param snap
+ * @return int
+ */
+static int newfs_snap_link(struct newfs_snap* snap) {
+    struct newfs_dentry* dentry = new_dentry(snap->name, NEWFS_DIR);     /* 名字引用快照表，不进名字区 */
+
+    if (dentry == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    dentry->ino     = NEWFS_ROOT_INO;
+    dentry->parent  = newfs_super.snap_dentry;
+    dentry->snap    = snap;
+    dentry->hash    = newfs_name_hash(dentry->fname, dentry->name_len);
+    if (newfs_dhash_add(&snap_inode, dentry) != NEWFS_ERROR_NONE) {
+        newfs_free_dentry(dentry);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    dentry->brother = snap_inode.dentrys;
+    snap_inode.dentrys = dentry;
+    snap_inode.dir_cnt++;
+    snap->dentry = dentry;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 载入活动imap和快照表，建立/.snapshots，需在块缓存就绪后、读根inode前调用
+ *
+ * @param newfs_super_d
+ * @param root_dentry
+ * @return int
+ */
+int newfs_snap_init(struct newfs_super_d* newfs_super_d, struct newfs_dentry* root_dentry) {
+    struct newfs_snap_d* snap_d;
+    struct newfs_snap*   snap;
+    int                  i, imap_sz;
+
+    newfs_super.inode_fixed_blks = (newfs_super.data_offset - newfs_super.inode_offset) / NEWFS_BLK_SZ();
+    newfs_super.inode_blks = NEWFS_ROUND_UP(newfs_super.max_ino, NEWFS_INODE_PER_BLK()) / NEWFS_INODE_PER_BLK();
+    imap_sz  = newfs_super.inode_blks * sizeof(int);
+    newfs_super.imap = (int*)malloc(imap_sz);
+    imap_disk = (int*)malloc(imap_sz);
+    snap_cnt = newfs_super_d->snap_cnt;
+    snap_blk = newfs_super_d->snap_blk;
+    imap_dno = newfs_super_d->imap_dno;
+    imap_disk_dno = imap_dno;
+    if (newfs_super.imap == NULL || imap_disk == NULL || snap_cnt < 0 || snap_cnt > NEWFS_MAX_SNAPS) {
+        return -NEWFS_ERROR_INVAL;
+    }
+    if (imap_dno == NEWFS_NULL_BLK) {                       /* inode区恒等映射，其余未分配 */
+        for (i = 0; i < newfs_super.inode_blks; i++) {
+            newfs_super.imap[i] = i < newfs_super.inode_fixed_blks ?
+                                  newfs_super.inode_offset / NEWFS_BLK_SZ() + i : NEWFS_NULL_BLK;
+        }
+    }
+    else if (newfs_driver_read(NEWFS_DATA_OFS(imap_dno), (uint8_t*)newfs_super.imap,
+                               imap_sz) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    memcpy(imap_disk, newfs_super.imap, imap_sz);
+
+    newfs_super.snap_dentry = new_dentry(NEWFS_SNAP_DIR, NEWFS_DIR);
+    newfs_super.snap_dentry->parent = root_dentry;
+    newfs_super.snap_dentry->inode  = &snap_inode;
+    memset(&snap_inode, 0, sizeof(snap_inode));
+    snap_inode.ino      = -1;
+    snap_inode.ftype    = NEWFS_DIR;
+    snap_inode.dentry   = newfs_super.snap_dentry;
+    snap_inode.frag_blk = NEWFS_NULL_BLK;
+    snap_inode.mode     = S_IFDIR | NEWFS_DEFAULT_PERM;
+    clock_gettime(CLOCK_REALTIME, &snap_inode.mtime);  /* 不持久化，取挂载时间 */
+    snap_inode.atime    = snap_inode.mtime;
+    snap_inode.ctime    = snap_inode.mtime;
+    for (i = 0; i < NEWFS_DATA_PER_FILE; i++) {
+        snap_inode.block_pointer[i] = NEWFS_NULL_BLK;
+    }
+    if (snap_cnt == 0) {
+        return NEWFS_ERROR_NONE;
+    }
+
+    snap_d = (struct newfs_snap_d*)malloc(snap_cnt * sizeof(struct newfs_snap_d));
+    if (snap_d == NULL || newfs_driver_read(NEWFS_DATA_OFS(snap_blk), (uint8_t*)snap_d,
+                            snap_cnt * sizeof(struct newfs_snap_d)) != NEWFS_ERROR_NONE) {
+        free(snap_d);
+        return -NEWFS_ERROR_IO;
+    }
+    for (i = 0; i < snap_cnt; i++) {
+        snap = &snaps[i];
+        memset(snap, 0, sizeof(*snap));
+        memcpy(snap->name, snap_d[i].name, NEWFS_SNAP_NAME);
+        snap->name[NEWFS_SNAP_NAME - 1] = '\0';
+        snap->imap_dno = snap_d[i].imap_dno;
+        snap->map_dno  = snap_d[i].map_dno;
+        snap->imap     = (int*)malloc(imap_sz);
+        if (snap->imap == NULL || newfs_driver_read(NEWFS_DATA_OFS(snap->imap_dno),
+                                      (uint8_t*)snap->imap, imap_sz) != NEWFS_ERROR_NONE) {
+            free(snap_d);
+            return -NEWFS_ERROR_IO;
+        }
+        if (newfs_snap_link(snap) != NEWFS_ERROR_NONE) {
+            free(snap_d);
+            return -NEWFS_ERROR_NOSPACE;
+        }
+    }
+    free(snap_d);
+
+    snap = newfs_snap_latest();
+    snap->map = (uint8_t*)malloc(newfs_snap_map_sz());
+    if (snap->map == NULL || newfs_driver_read(NEWFS_DATA_OFS(snap->map_dno), snap->map,
+                                               newfs_snap_map_sz()) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 为活动imap预留数据块，imap第一次偏离恒等映射之前调用
+ *
+ * 卸载时写回imap不再需要分配，磁盘写满后也能正常卸载
+ *
+ * @return int
+ */
+int newfs_snap_imap_reserve() {
+    int dno;
+
+    if (imap_dno != NEWFS_NULL_BLK) {
+        return NEWFS_ERROR_NONE;
+    }
+    dno = newfs_snap_alloc_run(newfs_snap_imap_blks());
+    if (dno < 0) {
+        return dno;
+    }
+    imap_dno = dno;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 活动imap所在数据块，尚未预留时为NEWFS_NULL_BLK
+ *
+ * @return int
+ */
+int newfs_snap_imap_dno() {
+    return imap_dno;
+}
+
+/**
+ * @brief fsync时把inode表块blk的映射写到磁盘上的imap，不启用日志时使用
+ *
+ * 其余项保留磁盘上的旧值，它们指向的表块可能尚未写回；imap刚预留时先写数据位图再整段写出，最后改写超级块中的imap_dno
+ *
+ * @param blk inode表块序号，对应的表块须已写回
+ * @return int
+ */
+int newfs_snap_imap_persist(int blk) {
+    struct newfs_super_d newfs_super_d;
+    int                  per_blk = NEWFS_BLK_SZ() / (int)sizeof(int);
+    int                  i, ofs, len;
+
+    if (imap_disk[blk] == newfs_super.imap[blk] && imap_disk_dno == imap_dno) {
+        return NEWFS_ERROR_NONE;
+    }
+    imap_disk[blk] = newfs_super.imap[blk];
+    if (imap_disk_dno == imap_dno) {                        /* 只写blk所在的一块 */
+        ofs = blk / per_blk * per_blk;
+        len = newfs_super.inode_blks - ofs < per_blk ? newfs_super.inode_blks - ofs : per_blk;
+        return newfs_driver_write(NEWFS_DATA_OFS(imap_dno) + ofs * (int)sizeof(int), (uint8_t*)(imap_disk + ofs),
+                                  len * (int)sizeof(int));
+    }
+    for (i = 0; i < newfs_snap_imap_blks(); i++) {
+        if (newfs_map_persist(FALSE, imap_dno + i) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    if (newfs_driver_write(NEWFS_DATA_OFS(imap_dno), (uint8_t*)imap_disk,
+                           newfs_super.inode_blks * sizeof(int)) != NEWFS_ERROR_NONE ||
+        newfs_driver_read(NEWFS_SUPER_OFS, (uint8_t*)&newfs_super_d, sizeof(newfs_super_d)) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_super_d.imap_dno = imap_dno;
+    if (newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t*)&newfs_super_d, sizeof(newfs_super_d)) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    imap_disk_dno = imap_dno;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 把快照表填入一块
+ *
+ * @param data 一块大小的缓冲区
+ */
+static void newfs_snap_table(uint8_t* data) {
+    struct newfs_snap_d* snap_d = (struct newfs_snap_d*)data;
+    int                  i;
+
+    memset(data, 0, NEWFS_BLK_SZ());
+    for (i = 0; i < snap_cnt; i++) {
+        memcpy(snap_d[i].name, snaps[i].name, NEWFS_SNAP_NAME);
+        snap_d[i].imap_dno = snaps[i].imap_dno;
+        snap_d[i].map_dno  = snaps[i].map_dno;
+    }
+}
+
+/**
+ * @brief 填写超级块中与快照相关的字段，提交日志时据此判断超级块是否需要记入事务
+ *
+ * @param newfs_super_d
+ */
+void newfs_snap_super(struct newfs_super_d* newfs_super_d) {
+    newfs_super_d->snap_cnt = snap_cnt;
+    newfs_super_d->snap_blk = snap_blk;
+    newfs_super_d->imap_dno = imap_dno;
+}
+
+/**
+ * @brief 新建的快照在返回前持久化
+ *
+ * 启用日志时把快照表写进缓存并提交事务；否则先写回脏inode和块缓存，
+ * 使冻结的imap和位图所指的内容都已落盘，再写快照表、imap、位图(只补上已分配的位)和超级块
+ *
+ * @return int
+ */
+static int newfs_snap_persist() {
+    struct newfs_super_d newfs_super_d;
+    uint8_t*             data;
+    int                  i, ret;
+
+    if (newfs_super.is_journal) {
+        data = newfs_bread(snap_blk, TRUE);
+        if (data == NULL) {
+            return -NEWFS_ERROR_IO;
+        }
+        newfs_snap_table(data);
+        newfs_bdirty_meta(snap_blk);
+        return newfs_journal_commit();
+    }
+    if (newfs_icache_sync() != NEWFS_ERROR_NONE || newfs_bflush() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    data = (uint8_t*)malloc(NEWFS_BLK_SZ());
+    if (data == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    newfs_snap_table(data);
+    ret = newfs_driver_write(NEWFS_DATA_OFS(snap_blk), data, NEWFS_BLK_SZ());
+    free(data);
+    if (ret != NEWFS_ERROR_NONE ||
+        newfs_driver_write(NEWFS_DATA_OFS(imap_dno), (uint8_t*)newfs_super.imap,
+                           newfs_super.inode_blks * sizeof(int)) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    memcpy(imap_disk, newfs_super.imap, newfs_super.inode_blks * sizeof(int));
+    for (i = 0; i < newfs_super.map_inode_blks; i++) {
+        if (newfs_map_persist(TRUE, NEWFS_BLKS_SZ(i) * UINT8_BITS) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    for (i = 0; i < newfs_super.map_data_blks; i++) {
+        if (newfs_map_persist(FALSE, NEWFS_BLKS_SZ(i) * UINT8_BITS) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    if (newfs_driver_read(NEWFS_SUPER_OFS, (uint8_t*)&newfs_super_d, sizeof(newfs_super_d)) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_snap_super(&newfs_super_d);
+    if (newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t*)&newfs_super_d, sizeof(newfs_super_d)) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    imap_disk_dno = imap_dno;
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 卸载时写回活动imap和快照表，需在写数据位图之前调用(可能分配数据块)
+ *
+ * @param newfs_super_d 填写快照相关字段
+ * @return int
+ */
+int newfs_snap_sync(struct newfs_super_d* newfs_super_d) {
+    uint8_t*             data;
+    int                  i, ret;
+    boolean              is_mapped = snap_cnt > 0 || imap_dno != NEWFS_NULL_BLK;
+
+    for (i = newfs_super.inode_fixed_blks; i < newfs_super.inode_blks && !is_mapped; i++) {
+        is_mapped = newfs_super.imap[i] != NEWFS_NULL_BLK;  /* inode表扩展过 */
+    }
+    if (is_mapped) {
+        if (imap_dno == NEWFS_NULL_BLK) {
+            imap_dno = newfs_snap_alloc_run(newfs_snap_imap_blks());
+        }
+        if (imap_dno < 0) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        if (newfs_driver_write(NEWFS_DATA_OFS(imap_dno), (uint8_t*)newfs_super.imap,
+                               newfs_super.inode_blks * sizeof(int)) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    if (snap_cnt > 0) {
+        if (snap_blk == NEWFS_NULL_BLK) {
+            snap_blk = newfs_alloc_data();
+        }
+        if (snap_blk < 0) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        data = (uint8_t*)malloc(NEWFS_BLK_SZ());
+        if (data == NULL) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        newfs_snap_table(data);
+        ret = newfs_driver_write(NEWFS_DATA_OFS(snap_blk), data, NEWFS_BLK_SZ());
+        free(data);
+        if (ret != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    newfs_snap_super(newfs_super_d);
+    return NEWFS_ERROR_NONE;
+}
+
+void newfs_snap_destroy() {
+    int i;
+    for (i = 0; i < snap_cnt; i++) {
+        free(snaps[i].imap);
+        free(snaps[i].map);
+        snaps[i].imap = NULL;
+        snaps[i].map  = NULL;
+    }
+    snap_cnt = 0;
+    free(snap_inode.dhash);
+    snap_inode.dhash    = NULL;
+    snap_inode.dhash_sz = 0;
+    free(newfs_super.imap);
+    free(imap_disk);
+    newfs_super.imap = NULL;
+    imap_disk = NULL;
+}
+
+/**
+ * @brief 创建快照(mkdir /.snapshots/<name>)
+ *
+ * 先把脏inode写进inode表块，再冻结imap和数据位图，代价与脏inode数和两者的大小有关，与磁盘上的数据量无关；
+ * 返回前提交日志(或不启用日志时写回块缓存)，快照不会因崩溃丢失
+ *
+ * @param name
+ * @return int
+ */
+int newfs_snap_create(const char* name) {
+    struct newfs_snap* snap;
+    int                imap_sz = newfs_super.inode_blks * sizeof(int);
+    int                i, ret;
+
+    if (strlen(name) >= NEWFS_SNAP_NAME) {
+        return -NEWFS_ERROR_INVAL;
+    }
+    if (snap_cnt == NEWFS_MAX_SNAPS) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (i = 0; i < snap_cnt; i++) {
+        if (strcmp(snaps[i].name, name) == 0) {
+            return -NEWFS_ERROR_EXISTS;
+        }
+    }
+    if (snap_blk == NEWFS_NULL_BLK) {                       /* 快照表和活动imap所在的块先预留 */
+        snap_blk = newfs_alloc_data();
+        if (snap_blk < 0) {
+            snap_blk = NEWFS_NULL_BLK;
+            return -NEWFS_ERROR_NOSPACE;
+        }
+    }
+    if (newfs_snap_imap_reserve() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    ret = newfs_icache_sync();
+    if (ret != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+
+    snap = &snaps[snap_cnt];
+    memset(snap, 0, sizeof(*snap));
+    strcpy(snap->name, name);
+    snap->imap_dno = newfs_snap_alloc_run(newfs_snap_imap_blks());
+    snap->map_dno  = snap->imap_dno < 0 ? -NEWFS_ERROR_NOSPACE :
+                     newfs_snap_alloc_run(newfs_super.map_data_blks);
+    if (snap->map_dno < 0) {
+        if (snap->imap_dno >= 0) {
+            newfs_snap_free_run(snap->imap_dno, newfs_snap_imap_blks());
+        }
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    /* 冻结的位图包含快照自身的元数据块，它们永远不会被活动文件系统释放 */
+    snap->imap = (int*)malloc(imap_sz);
+    snap->map  = (uint8_t*)malloc(newfs_snap_map_sz());
+    if (snap->imap == NULL || snap->map == NULL) {
+        free(snap->imap);
+        free(snap->map);
+        newfs_snap_free_run(snap->imap_dno, newfs_snap_imap_blks());
+        newfs_snap_free_run(snap->map_dno, newfs_super.map_data_blks);
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    memcpy(snap->imap, newfs_super.imap, imap_sz);
+    memcpy(snap->map, newfs_super.map_data, newfs_snap_map_sz());
+    if (newfs_driver_write(NEWFS_DATA_OFS(snap->imap_dno), (uint8_t*)snap->imap,
+                           imap_sz) != NEWFS_ERROR_NONE ||
+        newfs_driver_write(NEWFS_DATA_OFS(snap->map_dno), snap->map,
+                           newfs_snap_map_sz()) != NEWFS_ERROR_NONE) {
+        free(snap->imap);
+        free(snap->map);
+        return -NEWFS_ERROR_IO;
+    }
+
+    if (snap_cnt > 0) {                                     /* 只有最新快照的位图用于判断共享 */
+        free(snaps[snap_cnt - 1].map);
+        snaps[snap_cnt - 1].map = NULL;
+    }
+    snap_cnt++;
+    ret = newfs_snap_link(snap);
+    if (ret != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    return newfs_snap_persist();
+}
+
+/**
+ * @brief 数据块是否被最新快照引用
+ *
+ * @param dno
+ * @return boolean
+ */
+boolean newfs_snap_shared(int dno) {
+    struct newfs_snap* snap = newfs_snap_latest();
+    return snap != NULL && (snap->map[dno / UINT8_BITS] & (0x1 << (dno % UINT8_BITS))) != 0;
+}
+
+/**
+ * @brief 写inode记录前调用，inode所在的inode表块被最新快照引用时复制到新数据块
+ *
+ * @param ino
+ * @return int
+ */
+int newfs_snap_itab_cow(int ino) {
+    struct newfs_snap* snap = newfs_snap_latest();
+    int                blk  = ino / NEWFS_INODE_PER_BLK();
+    int                dno;
+    uint8_t*           src;
+    uint8_t*           dst;
+
+    if (snap == NULL || newfs_super.imap[blk] != snap->imap[blk]) {
+        return NEWFS_ERROR_NONE;
+    }
+    dno = newfs_alloc_data();
+    if (dno < 0) {
+        return dno;
+    }
+    src = newfs_bread(NEWFS_ITAB_DNO(newfs_super.imap, ino), FALSE);  /* inode表块经块缓存访问 */
+    dst = src == NULL ? NULL : newfs_bread(dno, TRUE);             /* 缓存至少两块，src仍有效 */
+    if (dst == NULL) {
+        newfs_free_data(dno);
+        return -NEWFS_ERROR_IO;
+    }
+    memcpy(dst, src, NEWFS_BLK_SZ());
+    newfs_bdirty(dno);
+    newfs_super.imap[blk] = newfs_super.data_offset / NEWFS_BLK_SZ() + dno;
+    return NEWFS_ERROR_NONE;
+}
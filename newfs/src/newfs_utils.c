@@ -2,6 +2,9 @@
 
 struct newfs_super      newfs_super; 
 struct custom_options newfs_options;
+static struct newfs_slab dentry_slab = NEWFS_SLAB_INIT("dentry", struct newfs_dentry);
+static uint8_t*          map_inode_disk;                /* 不启用日志时磁盘上的位图，fsync据此只补写新分配的位 */
+static uint8_t*          map_data_disk;
 /**
  * @brief 获取文件名
  * 
@@ -14,27 +17,24 @@ char* newfs_get_fname(const char* path) {
     return q;
 }
 /**
- * @brief 计算路径的层级
- * exm: /av/c/d/f
- * -> lvl = 4
- * @param path 
- * @return int 
+ * @brief 取路径中的下一个分量，跳过连续的'/'，不修改路径也不分配内存
+ * exm: /av//c/ -> "av"(2), "c"(1), NULL
+ * @param path 上一个分量之后的位置，首次调用传入整条路径
+ * @param len 返回分量长度
+ * @return const char* 分量起始位置，没有更多分量返回NULL
  */
-int newfs_calc_lvl(const char * path) {
-    // char* path_cpy = (char *)malloc(strlen(path));
-    // strcpy(path_cpy, path);
-    char* str = path;
-    int   lvl = 0;
-    if (strcmp(path, "/") == 0) {
-        return lvl;
+const char* newfs_path_next(const char* path, int* len) {
+    const char* end;
+
+    while (*path == '/') {
+        path++;
     }
-    while (*str != NULL) {
-        if (*str == '/') {
-            lvl++;
-        }
-        str++;
+    if (*path == '\0') {
+        return NULL;
     }
-    return lvl;
+    for (end = path; *end != '\0' && *end != '/'; end++);
+    *len = end - path;
+    return path;
 }
 /**
  * @brief 驱动读
@@ -48,8 +48,19 @@ int newfs_driver_read(int offset, uint8_t *out_content, int size) {
     int      offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_IO_SZ());
     int      bias           = offset - offset_aligned;
     int      size_aligned   = NEWFS_ROUND_UP((size + bias), NEWFS_IO_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
+    uint8_t  stack_buf[NEWFS_IO_STACK_SZ];
+    uint8_t* temp_content;
+    uint8_t* cur;
+    if (bias == 0 && size == size_aligned) {        /* 整IO单元读，直接读入调用者的缓冲 */
+        temp_content = out_content;
+    }
+    else if (size_aligned <= NEWFS_IO_STACK_SZ) {   /* inode等小记录不走malloc */
+        temp_content = stack_buf;
+    }
+    else {
+        temp_content = (uint8_t*)malloc(size_aligned);
+    }
+    cur = temp_content;
     // lseek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
     ddriver_seek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
     while (size_aligned != 0)
@@ -59,8 +70,12 @@ int newfs_driver_read(int offset, uint8_t *out_content, int size) {
         cur          += NEWFS_IO_SZ();
         size_aligned -= NEWFS_IO_SZ();   
     }
-    memcpy(out_content, temp_content + bias, size);
-    free(temp_content);
+    if (temp_content != out_content) {
+        memcpy(out_content, temp_content + bias, size);
+    }
+    if (temp_content != out_content && temp_content != stack_buf) {
+        free(temp_content);
+    }
     return NEWFS_ERROR_NONE;
 }
 /**
@@ -75,8 +90,19 @@ int newfs_driver_write(int offset, uint8_t *in_content, int size) {
     int      offset_aligned = NEWFS_ROUND_DOWN(offset, NEWFS_IO_SZ());
     int      bias           = offset - offset_aligned;
     int      size_aligned   = NEWFS_ROUND_UP((size + bias), NEWFS_IO_SZ());
-    uint8_t* temp_content   = (uint8_t*)malloc(size_aligned);
-    uint8_t* cur            = temp_content;
+    uint8_t  stack_buf[NEWFS_IO_STACK_SZ];
+    uint8_t* temp_content;
+    uint8_t* cur;
+    if (bias == 0 && size == size_aligned) {        /* 整IO单元写，无需先读 */
+        ddriver_seek(NEWFS_DRIVER(), offset_aligned, SEEK_SET);
+        for (cur = in_content; size_aligned != 0; cur += NEWFS_IO_SZ()) {
+            ddriver_write(NEWFS_DRIVER(), (char *)cur, NEWFS_IO_SZ());
+            size_aligned -= NEWFS_IO_SZ();
+        }
+        return NEWFS_ERROR_NONE;
+    }
+    temp_content = size_aligned <= NEWFS_IO_STACK_SZ ? stack_buf : (uint8_t*)malloc(size_aligned);
+    cur          = temp_content;
     newfs_driver_read(offset_aligned, temp_content, size_aligned);
     memcpy(temp_content + bias, in_content, size);
     
@@ -90,17 +116,324 @@ int newfs_driver_write(int offset, uint8_t *in_content, int size) {
         size_aligned -= NEWFS_IO_SZ();   
     }
 
-    free(temp_content);
+    if (temp_content != stack_buf) {
+        free(temp_content);
+    }
     return NEWFS_ERROR_NONE;
 }
 /**
- * @brief 将denry插入到inode中，采用头插法
+ * @brief 从slab中分配dentry
+ * 
+ * 名字只是借用fname，挂入目录时才由newfs_alloc_dentry复制到父目录的名字区，
+ * 因此fname须在此之前保持有效；根目录、快照等不属于任何名字区的dentry直接引用常量
+ * 
+ * @param fname 
+ * @param ftype 
+ * @return struct newfs_dentry* 
+ */
+struct newfs_dentry* new_dentry(const char* fname, NEWFS_FILE_TYPE ftype) {
+    struct newfs_dentry* dentry = (struct newfs_dentry*)newfs_slab_alloc(&dentry_slab);
+    if (dentry == NULL) {
+        return NULL;
+    }
+    memset(dentry, 0, sizeof(struct newfs_dentry));
+    dentry->fname    = fname;
+    dentry->name_len = fname == NULL ? 0 : (uint8_t)strnlen(fname, NEWFS_MAX_FILE_NAME - 1);
+    dentry->ftype    = ftype;
+    dentry->ino      = -1;
+    return dentry;
+}
+/**
+ * @brief 释放未挂入目录或已由newfs_drop_dentry移出的dentry，名字区中的名字随目录释放
+ * 
+ * @param dentry 
+ */
+void newfs_free_dentry(struct newfs_dentry* dentry) {
+    newfs_slab_free(&dentry_slab, dentry);
+}
+static int newfs_name_compact(struct newfs_inode* inode);
+/**
+ * @brief 把名字复制到目录inode的名字区，dentry->fname改为指向副本
+ * 
+ * 名字区按段分配，段不移动；删除目录项留下的空洞超过名字区的一半时，
+ * 在需要新段之前整理一次，此时子目录项的fname会改变
+ * 
+ * @param inode 目录
+ * @param dentry 
+ * @param fname 不必以'\0'结尾
+ * @param len 
+ * @return int 
+ */
+static int newfs_name_intern(struct newfs_inode* inode, struct newfs_dentry* dentry,
+                             const char* fname, int len) {
+    struct newfs_name_chunk* chunk = inode->names;
+    int                      cap;
+
+    if (chunk != NULL && chunk->used + len + 1 > chunk->cap && 
+        inode->names_dead >= NEWFS_NAME_CHUNK_SZ / 2 && newfs_name_compact(inode) == NEWFS_ERROR_NONE) {
+        chunk = inode->names;
+    }
+    if (chunk == NULL || chunk->used + len + 1 > chunk->cap) {
+        cap   = NEWFS_NAME_CHUNK_SZ - (int)sizeof(struct newfs_name_chunk);
+        chunk = (struct newfs_name_chunk*)malloc(sizeof(struct newfs_name_chunk) + cap);
+        if (chunk == NULL) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        chunk->next  = inode->names;
+        chunk->used  = 0;
+        chunk->cap   = cap;
+        inode->names = chunk;
+    }
+    memcpy(chunk->data + chunk->used, fname, len);
+    chunk->data[chunk->used + len] = '\0';
+    dentry->fname    = chunk->data + chunk->used;
+    dentry->name_len = (uint8_t)len;
+    chunk->used     += len + 1;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 整理名字区: 把仍在目录中的名字依次复制到新段，释放旧段
+ * 
+ * 只在空洞超过名字区的一半时整理，复制的字节数不超过此前删除的字节数，均摊为常数
+ * 
+ * @param inode 目录
+ * @return int 
+ */
+static int newfs_name_compact(struct newfs_inode* inode) {
+    struct newfs_name_chunk* old = inode->names;
+    struct newfs_name_chunk* chunk;
+    struct newfs_dentry*     dentry;
+    int                      used = 0;
+
+    for (chunk = old; chunk != NULL; chunk = chunk->next) {
+        used += chunk->used;
+    }
+    if (inode->names_dead * 2 < used) {
+        return -NEWFS_ERROR_INVAL;
+    }
+    inode->names      = NULL;
+    inode->names_dead = 0;
+    for (dentry = inode->dentrys; dentry != NULL; dentry = dentry->brother) {
+        if (newfs_name_intern(inode, dentry, dentry->fname, dentry->name_len) != NEWFS_ERROR_NONE) {
+            break;
+        }
+    }
+    if (dentry != NULL) {                               /* 内存不足: 旧段中仍有名字被引用，挂回去 */
+        for (chunk = inode->names; chunk != NULL && chunk->next != NULL; chunk = chunk->next);
+        if (chunk == NULL) {
+            inode->names = old;
+        }
+        else {
+            chunk->next = old;
+        }
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    while (old != NULL) {
+        chunk = old;
+        old   = chunk->next;
+        free(chunk);
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 释放目录的名字区，之后其子目录项的fname全部失效
+ * 
+ * @param inode 目录
+ */
+void newfs_free_names(struct newfs_inode* inode) {
+    struct newfs_name_chunk* chunk;
+
+    while (inode->names != NULL) {
+        chunk        = inode->names;
+        inode->names = chunk->next;
+        free(chunk);
+    }
+    inode->names_dead = 0;
+}
+/**
+ * @brief 文件名哈希(FNV-1a)，随目录项落盘
+ * 
+ * @param fname 不必以'\0'结尾
+ * @param len 
+ * @return uint32_t 
+ */
+uint32_t newfs_name_hash(const char* fname, int len) {
+    uint32_t hash = 2166136261U;
+    while (len-- > 0) {
+        hash ^= (uint8_t)*fname++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+/**
+ * @brief 把dentry加入目录inode的哈希表，目录项数达到桶数时先把表扩大一倍
+ * 
+ * 须在inode->dir_cnt增加之前调用，dentry->hash须已设置
+ * 
+ * @param inode 目录
+ * @param dentry 
+ * @return int 
+ */
+int newfs_dhash_add(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    struct newfs_dentry** dhash;
+    struct newfs_dentry*  cursor;
+    struct newfs_dentry*  next;
+    int                   sz, i;
+
+    if (inode->dir_cnt >= inode->dhash_sz) {
+        sz    = inode->dhash_sz == 0 ? NEWFS_DHASH_MIN : inode->dhash_sz * 2;
+        dhash = (struct newfs_dentry**)calloc(sz, sizeof(struct newfs_dentry*));
+        if (dhash == NULL) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        for (i = 0; i < inode->dhash_sz; i++) {
+            for (cursor = inode->dhash[i]; cursor != NULL; cursor = next) {
+                next = cursor->hash_next;
+                cursor->hash_next = dhash[cursor->hash & (sz - 1)];
+                dhash[cursor->hash & (sz - 1)] = cursor;
+            }
+        }
+        free(inode->dhash);
+        inode->dhash    = dhash;
+        inode->dhash_sz = sz;
+    }
+    i = dentry->hash & (inode->dhash_sz - 1);
+    dentry->hash_next = inode->dhash[i];
+    inode->dhash[i]   = dentry;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 在目录inode的哈希表中按名字查找目录项，先比较哈希和长度，都相同才比较名字
+ * 
+ * @param inode 目录
+ * @param fname 不必以'\0'结尾
+ * @param len 
+ * @return struct newfs_dentry* 找不到返回NULL
+ */
+struct newfs_dentry* newfs_dhash_find(struct newfs_inode* inode, const char* fname, int len) {
+    struct newfs_dentry* cursor;
+    uint32_t             hash;
+
+    if (inode->dhash_sz == 0) {
+        return NULL;
+    }
+    hash = newfs_name_hash(fname, len);
+    for (cursor = inode->dhash[hash & (inode->dhash_sz - 1)]; cursor != NULL; cursor = cursor->hash_next) {
+        if (cursor->hash == hash && cursor->name_len == len && memcmp(cursor->fname, fname, len) == 0) {
+            return cursor;
+        }
+    }
+    return NULL;
+}
+/**
+ * @brief 在目录块中为名字长name_len的目录项找位置(首次适配)，都放不下时追加一个目录块
+ * 
+ * @param inode 目录
+ * @param name_len 
+ * @param blk 返回目录内逻辑块号
+ * @param ofs 返回块内偏移，该处是空闲项或尾部有足够空闲空间的项
+ * @return int 
+ */
+static int newfs_dirent_find_slot(struct newfs_inode* inode, int name_len, int* blk, int* ofs) {
+    struct newfs_dentry_d* dentry_d;
+    uint8_t*               data;
+    int                    need = NEWFS_DIRENT_LEN(name_len);
+    int                    used, dno;
+
+    for (*blk = 0; *blk < NEWFS_DATA_PER_FILE && inode->block_pointer[*blk] != NEWFS_NULL_BLK; (*blk)++) {
+        data = newfs_bread(inode->block_pointer[*blk], FALSE);
+        if (data == NULL) {
+            return -NEWFS_ERROR_IO;
+        }
+        for (*ofs = 0; *ofs < NEWFS_BLK_SZ(); *ofs += NEWFS_REC_LEN(dentry_d)) {
+            dentry_d = (struct newfs_dentry_d*)(data + *ofs);
+            used     = dentry_d->name_len == 0 ? 0 : NEWFS_DIRENT_LEN(dentry_d->name_len);
+            if (NEWFS_REC_LEN(dentry_d) - used >= need) {
+                return NEWFS_ERROR_NONE;
+            }
+        }
+    }
+    if (*blk == NEWFS_DATA_PER_FILE) {                  //超出文件最大大小
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    dno = newfs_alloc_data();
+    if (dno < 0) {
+        return dno;
+    }
+    data = newfs_bread(dno, TRUE);
+    if (data == NULL) {
+        newfs_free_data(dno);
+        return -NEWFS_ERROR_IO;
+    }
+    dentry_d = (struct newfs_dentry_d*)data;            /* 新块只有一个覆盖整块的空闲项 */
+    dentry_d->ino      = 0;
+    dentry_d->hash     = 0;
+    dentry_d->rec_len  = (uint16_t)NEWFS_BLK_SZ();
+    dentry_d->name_len = 0;
+    dentry_d->ftype    = 0;
+    newfs_bdirty_meta(dno);
+    inode->block_pointer[*blk] = dno;
+    inode->size += NEWFS_BLK_SZ();
+    *ofs = 0;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 将denry插入到inode中，采用头插法，同时加入目录的哈希表，并在目录块中写入变长目录项
  * 
  * @param inode 
  * @param dentry 
  * @return int 
  */
 int newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    struct newfs_dentry_d* dentry_d;
+    struct newfs_dentry_d* split_d;
+    uint8_t*               data;
+    int                    name_len = strlen(dentry->fname);
+    int                    blk, ofs, used, dno, ret;
+
+    if (name_len >= NEWFS_MAX_FILE_NAME) {
+        return -NEWFS_ERROR_NAMETOOLONG;
+    }
+    ret = newfs_dirent_find_slot(inode, name_len, &blk, &ofs);
+    if (ret != NEWFS_ERROR_NONE) {
+        return ret;
+    }
+    dno = newfs_bunshare(inode, blk, FALSE);            /* 与快照共享的目录块先复制 */
+    if (dno < 0) {
+        return dno;
+    }
+    if (newfs_name_intern(inode, dentry, dentry->fname, name_len) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    dentry->hash = newfs_name_hash(dentry->fname, name_len);
+    if (newfs_dhash_add(inode, dentry) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    data = newfs_bread(dno, FALSE);
+    if (data == NULL) {
+        return -NEWFS_ERROR_IO;
+    }
+    dentry_d = (struct newfs_dentry_d*)(data + ofs);
+    if (dentry_d->name_len != 0) {                      /* 从已有项尾部的空闲空间切出新项 */
+        used    = NEWFS_DIRENT_LEN(dentry_d->name_len);
+        split_d = (struct newfs_dentry_d*)(data + ofs + used);
+        split_d->rec_len  = (uint16_t)(NEWFS_REC_LEN(dentry_d) - used);
+        dentry_d->rec_len = (uint16_t)used;
+        dentry_d = split_d;
+        ofs     += used;
+    }
+    dentry_d->ino      = dentry->ino;                   /* 尚未分配inode时在同步时补写 */
+    dentry_d->hash     = dentry->hash;
+    dentry_d->name_len = (uint8_t)name_len;
+    dentry_d->ftype    = (uint8_t)dentry->ftype;
+    memcpy(dentry_d->name, dentry->fname, name_len);
+    newfs_bdirty_meta(dno);
+    dentry->dblk = (uint8_t)blk;
+    dentry->dofs = (uint16_t)ofs;
+    dentry->dirty_next = inode->dirty_dents;            /* ino在同步时补写 */
+    inode->dirty_dents = dentry;
+    newfs_inode_dirty(inode);
+
     if (inode->dentrys == NULL) {
         inode->dentrys = dentry;
     }
@@ -109,43 +442,391 @@ int newfs_alloc_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
         inode->dentrys = dentry;
     }
     inode->dir_cnt++;
+    return inode->dir_cnt;
+}
+/**
+ * @brief 从目录中删除dentry: 磁盘目录项并入块内前一项的rec_len，块首项则标记为空闲；
+ * 同时移出目录项链表和哈希表，删除的是readdir游标尚未列出的项时调整游标，dentry本身由调用者释放
+ * 
+ * @param inode 目录
+ * @param dentry 
+ * @return int 剩余目录项数
+ */
+int newfs_drop_dentry(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    struct newfs_dentry_d* prev_d = NULL;
+    struct newfs_dentry_d* dentry_d;
+    struct newfs_dentry**  link;
+    struct newfs_dir_cursor* cursor;
+    struct newfs_dentry*   next;
+    uint8_t*               data;
+    int                    dno, ofs;
 
-    int cur_blk = inode->dir_cnt / NEWFS_MAX_DENTRY_BLK();    
-    if(inode->dir_cnt % NEWFS_MAX_DENTRY_BLK() == 1){
-        if(cur_blk == NEWFS_DATA_PER_FILE){ //超出文件最大大小
-            return -1;
-        }
-        int byte_cursor = 0; 
-        int bit_cursor  = 0;
-        int data_cursor  = 0;
-        boolean is_find_free_entry = FALSE;
-        //根据数据块位图查找空闲数据块
-        for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.map_data_blks); byte_cursor++)
-        {   
-            for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
-                if((newfs_super.map_data[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
-                    newfs_super.map_data[byte_cursor] |= (0x1 << bit_cursor);
-                    inode->block_pointer[cur_blk] = data_cursor;
-                    is_find_free_entry = TRUE;
-                    break;
-                }
-                data_cursor++;
+    for (link = &inode->dentrys; *link != NULL && *link != dentry; link = &(*link)->brother);
+    if (*link == NULL) {
+        return -NEWFS_ERROR_NOTFOUND;
+    }
+    dno = newfs_bunshare(inode, dentry->dblk, FALSE);
+    if (dno < 0) {
+        return dno;
+    }
+    data = newfs_bread(dno, FALSE);
+    if (data == NULL) {
+        return -NEWFS_ERROR_IO;
+    }
+    for (ofs = 0; ofs < dentry->dofs; ofs += NEWFS_REC_LEN(prev_d)) {
+        prev_d = (struct newfs_dentry_d*)(data + ofs);
+    }
+    dentry_d = (struct newfs_dentry_d*)(data + dentry->dofs);
+    if (prev_d == NULL) {
+        dentry_d->name_len = 0;
+        dentry_d->ino      = 0;
+    }
+    else {
+        prev_d->rec_len = (uint16_t)(NEWFS_REC_LEN(prev_d) + NEWFS_REC_LEN(dentry_d));
+    }
+    newfs_bdirty_meta(dno);
+    newfs_pcache_inval(inode, dentry);
+    newfs_inode_dirty(inode);
+
+    for (cursor = inode->cursors; cursor != NULL; cursor = cursor->link) {
+        for (next = cursor->next; next != NULL && next != dentry; next = next->brother);
+        if (next == NULL) {                             /* 已列出，未列出项到链表尾的项数不变 */
+            continue;
+        }
+        if (cursor->next == dentry) {                   /* pos不变，内核仍按原offset续读 */
+            cursor->next = dentry->brother;
+        }
+        cursor->left--;
+    }
+    *link = dentry->brother;
+    for (link = &inode->dirty_dents; *link != NULL && *link != dentry; link = &(*link)->dirty_next);
+    if (*link != NULL) {
+        *link = dentry->dirty_next;
+    }
+    for (link = &inode->dhash[dentry->hash & (inode->dhash_sz - 1)]; *link != dentry; 
+         link = &(*link)->hash_next);
+    *link = dentry->hash_next;
+    inode->dir_cnt--;
+    inode->names_dead += dentry->name_len + 1;
+    return inode->dir_cnt;
+}
+/**
+ * @brief 把内存dentry的ino补写到磁盘目录项(创建时inode尚未分配)
+ * 
+ * @param inode 目录
+ * @param dentry 
+ * @return int 
+ */
+static int newfs_dirent_update(struct newfs_inode* inode, struct newfs_dentry* dentry) {
+    struct newfs_dentry_d* dentry_d;
+    uint8_t*               data = newfs_bread(inode->block_pointer[dentry->dblk], FALSE);
+    int                    dno;
+
+    if (data == NULL) {
+        return -NEWFS_ERROR_IO;
+    }
+    dentry_d = (struct newfs_dentry_d*)(data + dentry->dofs);
+    if (dentry_d->ino == (uint32_t)dentry->ino) {
+        return NEWFS_ERROR_NONE;
+    }
+    dno = newfs_bunshare(inode, dentry->dblk, FALSE);
+    data = dno < 0 ? NULL : newfs_bread(dno, FALSE);
+    if (data == NULL) {
+        return dno < 0 ? dno : -NEWFS_ERROR_IO;
+    }
+    dentry_d = (struct newfs_dentry_d*)(data + dentry->dofs);
+    dentry_d->ino = dentry->ino;
+    newfs_bdirty_meta(dno);
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 在数据块位图中分配一个空闲数据块
+ * 
+ * @return int 数据块号，失败返回-NEWFS_ERROR_NOSPACE
+ */
+int newfs_alloc_data() {
+    int byte_cursor = 0; 
+    int bit_cursor  = 0;
+    int data_cursor = 0;
+
+    for (byte_cursor = 0; byte_cursor < NEWFS_BLKS_SZ(newfs_super.map_data_blks); byte_cursor++)
+    {
+        if (newfs_super.map_data[byte_cursor] == 0xFF) {
+            data_cursor += UINT8_BITS;
+            continue;
+        }
+        for (bit_cursor = 0; bit_cursor < UINT8_BITS; bit_cursor++) {
+            if (data_cursor >= newfs_super.max_data) {
+                return -NEWFS_ERROR_NOSPACE;
             }
-            if (is_find_free_entry) {
-                break;
+            if((newfs_super.map_data[byte_cursor] & (0x1 << bit_cursor)) == 0) {    
+                newfs_super.map_data[byte_cursor] |= (0x1 << bit_cursor);
+                return data_cursor;
             }
+            data_cursor++;
         }
-        if (!is_find_free_entry || data_cursor == newfs_super.max_data)
-            return -NEWFS_ERROR_NOSPACE;
     }
-    return inode->dir_cnt;
+    return -NEWFS_ERROR_NOSPACE;
+}
+/**
+ * @brief 释放数据块，清除位图并丢弃其缓存；去重共享的块只减少引用，快照引用的块不释放
+ * 
+ * @param dno 
+ */
+void newfs_free_data(int dno) {
+    if (newfs_dedup_unref(dno) || newfs_snap_shared(dno)) {  /* 快照引用的块保留 */
+        return;
+    }
+    newfs_super.map_data[dno / UINT8_BITS] &= (uint8_t)(~(0x1 << (dno % UINT8_BITS)));
+    newfs_binval(dno);
+    newfs_journal_revoke(dno);                                /* 重放时不能再用日志中的旧副本覆盖 */
+}
+/**
+ * @brief fsync时把位图中bit所在的块写到磁盘，只补上已分配的位，不启用日志时使用
+ *
+ * 已清除的位留到卸载时写回: 释放它的目录项、inode记录可能尚未落盘，提前清除会让崩溃后仍被引用的块被再次分配
+ *
+ * @param is_inode TRUE为inode位图，否则为数据位图
+ * @param bit ino或数据块号
+ * @return int
+ */
+int newfs_map_persist(boolean is_inode, int bit) {
+    uint8_t* map    = is_inode ? newfs_super.map_inode : newfs_super.map_data;
+    uint8_t* disk   = is_inode ? map_inode_disk : map_data_disk;
+    int      offset = is_inode ? newfs_super.map_inode_offset : newfs_super.map_data_offset;
+    int      ofs    = NEWFS_ROUND_DOWN(bit / UINT8_BITS, NEWFS_BLK_SZ());
+    boolean  is_new = FALSE;
+
+    for (int i = ofs; i < ofs + NEWFS_BLK_SZ(); i++) {
+        if (map[i] & ~disk[i]) {
+            disk[i] |= map[i];
+            is_new   = TRUE;
+        }
+    }
+    if (is_new && newfs_driver_write(offset + ofs, disk + ofs, NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 将文件内的逻辑块号映射为数据块号
+ * 
+ * @param inode 
+ * @param blk 文件内逻辑块号
+ * @param create 未分配时是否分配
+ * @return int 数据块号；未分配且不创建时返回NEWFS_NULL_BLK；出错返回负错误号
+ */
+int newfs_bmap(struct newfs_inode * inode, int blk, boolean create) {
+    int dno;
+    if (blk >= NEWFS_DATA_PER_FILE) {
+        return -NEWFS_ERROR_FBIG;
+    }
+    dno = inode->block_pointer[blk];
+    if (dno != NEWFS_NULL_BLK || !create) {
+        return dno;
+    }
+    dno = newfs_alloc_data();
+    if (dno < 0) {
+        return dno;
+    }
+    inode->block_pointer[blk] = dno;
+    newfs_inode_dirty_blocks(inode);
+    return dno;
 }
+/**
+ * @brief 写文件的第blk块之前调用，若该块与其他文件或快照共享则复制出私有块(写时复制)
+ * 
+ * @param inode 
+ * @param blk 文件内逻辑块号，须已分配
+ * @param is_new 调用者将覆盖整块，不必复制旧内容
+ * @return int 私有的数据块号，出错返回负错误号
+ */
+int newfs_bunshare(struct newfs_inode * inode, int blk, boolean is_new) {
+    int      dno = inode->block_pointer[blk];
+    int      new_dno;
+    uint8_t* src = NULL;
+    uint8_t* dst;
 
+    if (!newfs_dedup_shared(dno) && !newfs_snap_shared(dno)) {
+        return dno;
+    }
+    new_dno = newfs_alloc_data();
+    if (new_dno < 0) {
+        return new_dno;
+    }
+    if (!is_new && (src = newfs_bread(dno, FALSE)) == NULL) {
+        newfs_free_data(new_dno);
+        return -NEWFS_ERROR_IO;
+    }
+    dst = newfs_bread(new_dno, TRUE);                     /* 缓存至少两块，src仍有效 */
+    if (dst == NULL) {
+        newfs_free_data(new_dno);
+        return -NEWFS_ERROR_IO;
+    }
+    if (src != NULL) {
+        memcpy(dst, src, NEWFS_BLK_SZ());
+    }
+    if (NEWFS_IS_DIR(inode)) {
+        newfs_bdirty_meta(new_dno);
+    }
+    else {
+        newfs_bdirty(new_dno);
+    }
+    newfs_free_data(dno);
+    inode->block_pointer[blk] = new_dno;
+    newfs_inode_dirty_blocks(inode);
+    return new_dno;
+}
+static inline boolean newfs_time_after(const struct timespec* a, const struct timespec* b) {
+    return a->tv_sec > b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+/**
+ * @brief 读操作后按挂载时的atime策略更新atime
+ *
+ * @param inode
+ */
+void newfs_inode_atime(struct newfs_inode * inode) {
+    struct timespec now;
+
+    if (newfs_super.atime_policy == NEWFS_ATIME_NOATIME || inode->dentry->snap != NULL) {
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (newfs_super.atime_policy == NEWFS_ATIME_RELATIME &&
+        newfs_time_after(&inode->atime, &inode->mtime) && newfs_time_after(&inode->atime, &inode->ctime) &&
+        now.tv_sec - inode->atime.tv_sec < NEWFS_RELATIME_SEC) {
+        return;
+    }
+    inode->atime = now;
+    if (newfs_super.atime_policy != NEWFS_ATIME_LAZYTIME) {
+        newfs_inode_dirty(inode);
+    }
+    else {
+        newfs_inode_dirty_time(inode);
+    }
+}
+/**
+ * @brief 内容被修改: mtime和ctime取当前时间
+ *
+ * @param inode
+ */
+void newfs_inode_mtime(struct newfs_inode * inode) {
+    clock_gettime(CLOCK_REALTIME, &inode->mtime);
+    inode->ctime = inode->mtime;
+    newfs_inode_dirty(inode);
+}
+/**
+ * @brief v2 inode记录的校验和，覆盖checksum之前的所有字节
+ *
+ * @param inode_d
+ * @return uint32_t
+ */
+static inline uint32_t newfs_inode_csum(const struct newfs_inode_d2* inode_d) {
+    return newfs_name_hash((const char*)inode_d, offsetof(struct newfs_inode_d2, checksum));
+}
+/**
+ * @brief 从inode表块中取出ino的记录，统一转换为v2格式
+ *
+ * v1记录没有的字段按旧的默认值填充: 权限NEWFS_DEFAULT_PERM、属主为挂载者、时间为0
+ *
+ * @param itab inode表块
+ * @param ino
+ * @param inode_d 输出
+ * @return int v2记录校验和不符返回-NEWFS_ERROR_IO
+ */
+int newfs_inode_decode(const uint8_t* itab, int ino, struct newfs_inode_d2* inode_d) {
+    const struct newfs_inode_d* v1;
+    int i;
+
+    if (newfs_super.features & NEWFS_FEATURE_INODE_V2) {
+        memcpy(inode_d, itab + NEWFS_ITAB_REC(ino), sizeof(struct newfs_inode_d2));
+        return inode_d->checksum == newfs_inode_csum(inode_d) ? NEWFS_ERROR_NONE : -NEWFS_ERROR_IO;
+    }
+    v1 = (const struct newfs_inode_d*)(itab + NEWFS_ITAB_REC(ino));
+    memset(inode_d, 0, sizeof(struct newfs_inode_d2));
+    inode_d->ino      = v1->ino;
+    inode_d->size     = v1->size;
+    inode_d->link     = 1;
+    inode_d->dir_cnt  = v1->dir_cnt;
+    inode_d->ftype    = v1->ftype;
+    inode_d->mode     = NEWFS_DEFAULT_PERM | (v1->ftype == NEWFS_DIR ? S_IFDIR : S_IFREG);
+    inode_d->uid      = getuid();
+    inode_d->gid      = getgid();
+    for (i = 0; i < NEWFS_DATA_PER_FILE; i++) {
+        inode_d->block_pointer[i] = v1->block_pointer[i];
+    }
+    inode_d->frag_blk = v1->frag_blk;
+    inode_d->frag_ofs = v1->frag_ofs;
+    inode_d->frag_len = v1->frag_len;
+    inode_d->zlen     = v1->zlen;
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 把v2格式的记录写入inode表块中ino的位置，v1格式只写旧字段
+ *
+ * @param itab inode表块
+ * @param ino
+ * @param inode_d checksum由此函数填写
+ */
+void newfs_inode_encode(uint8_t* itab, int ino, struct newfs_inode_d2* inode_d) {
+    struct newfs_inode_d* v1;
+    int i;
+
+    if (newfs_super.features & NEWFS_FEATURE_INODE_V2) {
+        inode_d->checksum = newfs_inode_csum(inode_d);
+        memcpy(itab + NEWFS_ITAB_REC(ino), inode_d, sizeof(struct newfs_inode_d2));
+        return;
+    }
+    v1 = (struct newfs_inode_d*)(itab + NEWFS_ITAB_REC(ino));
+    v1->ino      = inode_d->ino;
+    v1->size     = inode_d->size;
+    v1->link     = inode_d->link;
+    v1->dir_cnt  = inode_d->dir_cnt;
+    v1->ftype    = inode_d->ftype;
+    for (i = 0; i < NEWFS_DATA_PER_FILE; i++) {
+        v1->block_pointer[i] = inode_d->block_pointer[i];
+    }
+    v1->frag_blk = inode_d->frag_blk;
+    v1->frag_ofs = inode_d->frag_ofs;
+    v1->frag_len = inode_d->frag_len;
+    v1->zlen     = inode_d->zlen;
+}
+/**
+ * @brief 确保ino所在的inode表块已分配，inode区之外的表块第一次使用时从数据区分配
+ *
+ * 表块清零后经块缓存写回，之后即使其中的inode全部释放也不归还
+ *
+ * @param ino
+ * @return int
+ */
+static int newfs_alloc_itab(int ino) {
+    int blk = ino / NEWFS_INODE_PER_BLK();
+    int dno;
+
+    if (newfs_super.imap[blk] != NEWFS_NULL_BLK) {
+        return NEWFS_ERROR_NONE;
+    }
+    if (newfs_snap_imap_reserve() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    dno = newfs_alloc_data();
+    if (dno < 0) {
+        return dno;
+    }
+    if (newfs_bread(dno, TRUE) == NULL) {
+        newfs_free_data(dno);
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_bdirty(dno);
+    newfs_super.imap[blk] = newfs_super.data_offset / NEWFS_BLK_SZ() + dno;
+    return NEWFS_ERROR_NONE;
+}
 /**
  * @brief 分配一个inode，占用位图
  * 
  * @param dentry 该dentry指向分配的inode
- * @return newfs_inode
+ * @return newfs_inode inode用尽时返回NULL
  */
 struct newfs_inode* newfs_alloc_inode(struct newfs_dentry * dentry) {
     struct newfs_inode* inode;
@@ -171,12 +852,27 @@ struct newfs_inode* newfs_alloc_inode(struct newfs_dentry * dentry) {
         }
     }
 
-    if (!is_find_free_entry || ino_cursor == newfs_super.max_ino)
-        return -NEWFS_ERROR_NOSPACE;
+    if (!is_find_free_entry || ino_cursor >= newfs_super.max_ino) {
+        if (is_find_free_entry) {                   /* 位图末尾超出max_ino的位不可用 */
+            newfs_super.map_inode[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
+        }
+        return NULL;
+    }
 
-    inode = (struct newfs_inode*)malloc(sizeof(struct newfs_inode));
+    inode = newfs_alloc_itab(ino_cursor) == NEWFS_ERROR_NONE ? newfs_icache_alloc() : NULL;
+    if (inode == NULL) {
+        newfs_super.map_inode[byte_cursor] &= (uint8_t)(~(0x1 << bit_cursor));
+        return NULL;
+    }
     inode->ino  = ino_cursor; 
     inode->size = 0;
+    inode->link = 1;
+    inode->mode = NEWFS_DEFAULT_PERM | (dentry->ftype == NEWFS_DIR ? S_IFDIR : S_IFREG);
+    inode->uid  = getuid();
+    inode->gid  = getgid();
+    clock_gettime(CLOCK_REALTIME, &inode->ctime);
+    inode->atime = inode->ctime;
+    inode->mtime = inode->ctime;
 
     /* dentry指向inode */
     dentry->inode = inode;
@@ -186,84 +882,243 @@ struct newfs_inode* newfs_alloc_inode(struct newfs_dentry * dentry) {
 
     inode->dir_cnt = 0;
     inode->dentrys = NULL;
+    inode->dhash    = NULL;
+    inode->dhash_sz = 0;
+    inode->dirty_dents = NULL;
+    inode->names    = NULL;
+    inode->names_dead = 0;
+    inode->cursors  = NULL;
+    inode->gen      = 0;
     
-    //普通文件也不需要分配数据块了，分配数据块的过程会在写入文件时进行
-    // if (NEWFS_IS_REG(inode)) {
-    //     for(int i=0; i<NEWFS_DATA_PER_FILE; i++){
-    //         inode->data[i] = (uint8_t *)malloc(NEWFS_BLK_SZ());
-    //     }
-    // }
+    /* 数据块在写入时才分配 */
+    for(int i=0; i<NEWFS_DATA_PER_FILE; i++){
+        inode->block_pointer[i] = NEWFS_NULL_BLK;
+    }
+    inode->frag_blk = NEWFS_NULL_BLK;
+    inode->frag_ofs = 0;
+    inode->frag_len = 0;
+    inode->zlen     = 0;
+    newfs_icache_add(inode);
+    newfs_inode_dirty(inode);
 
     return inode;
 }
 /**
- * @brief 将内存inode及其下方结构全部刷回磁盘
+ * @brief 链接数降为0时释放inode: 归还数据块、碎片尾部和位图，并移出inode缓存
+ * 
+ * @param inode 普通文件，已没有dentry指向它
+ */
+void newfs_free_inode(struct newfs_inode * inode) {
+    int ino = inode->ino;
+
+    for (int i = 0; i < NEWFS_DATA_PER_FILE; i++) {
+        if (inode->block_pointer[i] != NEWFS_NULL_BLK) {
+            newfs_free_data(inode->block_pointer[i]);
+        }
+    }
+    if (inode->frag_blk != NEWFS_NULL_BLK) {
+        newfs_frag_free(inode->frag_blk, inode->frag_ofs, inode->frag_len);
+    }
+    newfs_super.map_inode[ino / UINT8_BITS] &= (uint8_t)(~(0x1 << (ino % UINT8_BITS)));
+    newfs_icache_remove(inode);
+}
+/**
+ * @brief 将内存inode及其脏目录项写回块缓存，由newfs_bflush落盘
  * 
  * @param inode 
  * @return int 
  */
 int newfs_sync_inode(struct newfs_inode * inode) {
-    struct newfs_inode_d  inode_d;
+    struct newfs_inode_d2 inode_d;
     struct newfs_dentry*  dentry_cursor;
-    struct newfs_dentry_d dentry_d;
+    uint8_t*              itab;
     int ino             = inode->ino;
 
-    int offset;
+    if (NEWFS_IS_REG(inode) && newfs_super.is_compress) {
+        if (newfs_zip_pack(inode) != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] compress ino %d failed\n", __func__, ino);
+        }
+    }
+    if (NEWFS_IS_REG(inode) && newfs_super.is_tailpack) {
+        if (newfs_frag_pack(inode) != NEWFS_ERROR_NONE) {
+            NEWFS_DBG("[%s] pack tail of ino %d failed\n", __func__, ino);
+        }
+    }
+
+    if (NEWFS_IS_DIR(inode)) {              /* 只补写脏目录项，写时复制可能改变块指针，须在写inode前 */
+        while (inode->dirty_dents != NULL) {
+            dentry_cursor = inode->dirty_dents;
+            if (newfs_dirent_update(inode, dentry_cursor) != NEWFS_ERROR_NONE) {
+                return -NEWFS_ERROR_IO;
+            }
+            inode->dirty_dents        = dentry_cursor->dirty_next;
+            dentry_cursor->dirty_next = NULL;
+        }
+    }
+
+    memset(&inode_d, 0, sizeof(inode_d));
     inode_d.ino         = ino;
     inode_d.size        = inode->size;
+    inode_d.link        = inode->link;
     inode_d.ftype       = inode->dentry->ftype;
     inode_d.dir_cnt     = inode->dir_cnt;
+    inode_d.mode        = inode->mode;
+    inode_d.uid         = inode->uid;
+    inode_d.gid         = inode->gid;
+    inode_d.atime_sec   = inode->atime.tv_sec;
+    inode_d.atime_nsec  = inode->atime.tv_nsec;
+    inode_d.mtime_sec   = inode->mtime.tv_sec;
+    inode_d.mtime_nsec  = inode->mtime.tv_nsec;
+    inode_d.ctime_sec   = inode->ctime.tv_sec;
+    inode_d.ctime_nsec  = inode->ctime.tv_nsec;
     for(int i=0; i<NEWFS_DATA_PER_FILE; i++){
         inode_d.block_pointer[i] = inode->block_pointer[i];
     }
-    /* 先写inode本身 */
-    if (newfs_driver_write(NEWFS_INO_OFS(ino/16) + ino%16*sizeof(struct newfs_inode_d), (uint8_t *)&inode_d, 
-                     sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE) {
+    inode_d.frag_blk    = inode->frag_blk;
+    inode_d.frag_ofs    = inode->frag_ofs;
+    inode_d.frag_len    = inode->frag_len;
+    inode_d.zlen        = inode->zlen;
+    /* 先写inode本身，只改缓存中的inode表块，同一块内的脏inode由newfs_bflush一次写回 */
+    if (newfs_snap_itab_cow(ino) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    itab = newfs_bread(NEWFS_ITAB_DNO(newfs_super.imap, ino), FALSE);
+    if (itab == NULL) {
         NEWFS_DBG("[%s] io error\n", __func__);
         return -NEWFS_ERROR_IO;
     }
+    newfs_inode_encode(itab, ino, &inode_d);
+    newfs_bdirty_meta(NEWFS_ITAB_DNO(newfs_super.imap, ino));
+    newfs_inode_clean(inode);
+
+    /* 目录项和普通文件的数据位于块缓存中，由newfs_bflush统一写回；子inode各自在脏inode链表中 */
+    return NEWFS_ERROR_NONE;
+}
+
+static int newfs_fsync_dents(struct newfs_inode * dir);
+/**
+ * @brief 写回inode的脏数据块，is_meta时连同inode记录
+ *
+ * @param inode
+ * @param is_meta
+ * @return int
+ */
+static int newfs_fsync_one(struct newfs_inode * inode, boolean is_meta) {
+    if (is_meta && NEWFS_IS_DIR(inode) && newfs_fsync_dents(inode) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    /* 先在缓存中更新inode，同步时的打包/压缩可能改变块指针 */
+    if (is_meta && (inode->flags & (NEWFS_FLAG_INODE_DIRTY | NEWFS_FLAG_INODE_LAZY)) &&
+        newfs_sync_inode(inode) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    for (int i = 0; i < NEWFS_DATA_PER_FILE; i++) {
+        if (inode->block_pointer[i] != NEWFS_NULL_BLK && 
+            newfs_bsync(inode->block_pointer[i]) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    if (inode->frag_blk != NEWFS_NULL_BLK && newfs_bsync(inode->frag_blk) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (is_meta && !newfs_super.is_journal &&              /* 启用日志时inode表块经日志提交 */
+        newfs_bsync(NEWFS_ITAB_DNO(newfs_super.imap, inode->ino)) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 不启用日志时fsync补写inode用到的分配信息: inode位图、数据块和inode表块的数据位图，
+ * 以及按需分配的inode表块在imap中的映射
+ *
+ * @param inode 数据块和inode表块须已写回
+ * @return int
+ */
+static int newfs_fsync_alloc(struct newfs_inode * inode) {
+    int itab_dno = NEWFS_ITAB_DNO(newfs_super.imap, inode->ino);
 
-    /* 再写inode下方的数据 */
-    if (NEWFS_IS_DIR(inode)) { /* 如果当前inode是目录，那么数据是目录项，且目录项的inode也要写回 */                          
-        dentry_cursor = inode->dentrys;
-        int blk_number = 0;   
-        
-        while (dentry_cursor != NULL && blk_number < NEWFS_DATA_PER_FILE)
-        {
-            offset = NEWFS_DATA_OFS(inode->block_pointer[blk_number]);
-            while ((dentry_cursor != NULL) && (offset < NEWFS_DATA_OFS(inode->block_pointer[blk_number] + 1))){
-                     memcpy(dentry_d.fname, dentry_cursor->fname, NEWFS_MAX_FILE_NAME);
-                    dentry_d.ftype = dentry_cursor->ftype;
-                    dentry_d.ino = dentry_cursor->ino;
-                    if (newfs_driver_write(offset, (uint8_t *)&dentry_d, 
-                                 sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE) {
-                        NEWFS_DBG("[%s] io error\n", __func__);
-                        return -NEWFS_ERROR_IO;                     
-                    }
-            
-                    if (dentry_cursor->inode != NULL) {
-                        newfs_sync_inode(dentry_cursor->inode);
-                    }
-
-                    dentry_cursor = dentry_cursor->brother;
-                    offset += sizeof(struct newfs_dentry_d);
-             }
-           blk_number++;
-        }
-    }
-    else if (NEWFS_IS_REG(inode)) { /* 如果当前inode是文件，那么数据是文件内容，直接写即可 */
-        for(int i=0; i<inode->size/NEWFS_BLK_SZ(); i++){
-                if (newfs_driver_write(NEWFS_DATA_OFS(inode->block_pointer[i]), (uint8_t *)inode->data[i], 
-                             NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
-            NEWFS_DBG("[%s] io error\n", __func__);
+    if (newfs_map_persist(TRUE, inode->ino) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    for (int i = 0; i < NEWFS_DATA_PER_FILE; i++) {
+        if (inode->block_pointer[i] != NEWFS_NULL_BLK &&
+            newfs_map_persist(FALSE, inode->block_pointer[i]) != NEWFS_ERROR_NONE) {
             return -NEWFS_ERROR_IO;
         }
+    }
+    if (inode->frag_blk != NEWFS_NULL_BLK && newfs_map_persist(FALSE, inode->frag_blk) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (itab_dno >= 0 &&                                    /* inode表块在数据区，映射记在imap中 */
+        (newfs_map_persist(FALSE, itab_dno) != NEWFS_ERROR_NONE ||
+         newfs_snap_imap_persist(inode->ino / NEWFS_INODE_PER_BLK()) != NEWFS_ERROR_NONE)) {
+        return -NEWFS_ERROR_IO;
+    }
+    return NEWFS_ERROR_NONE;
+}
+/**
+ * @brief 目录项块写回前，其中新写入的名字须指向已落盘的inode，新建的子目录向下递归
+ *
+ * @param dir
+ * @return int
+ */
+static int newfs_fsync_dents(struct newfs_inode * dir) {
+    struct newfs_dentry* child;
+
+    for (child = dir->dirty_dents; child != NULL; child = child->dirty_next) {
+        if (child->inode != NULL && (child->inode->flags & (NEWFS_FLAG_INODE_DIRTY | NEWFS_FLAG_INODE_LAZY)) &&
+            newfs_fsync_one(child->inode, TRUE) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
         }
-        
     }
     return NEWFS_ERROR_NONE;
 }
+/**
+ * @brief fsync: 只把该inode的脏数据块、inode记录和通往它的各级目录项块写到磁盘
+ *
+ * 位图只补写这些inode和块所在的位图块，imap只补写其inode表块的映射，其余仍在卸载时写回；
+ * 启用日志时数据块写回后提交整个事务，不再逐级写目录项块
+ *
+ * @param inode 非快照中的inode
+ * @param datasync 为TRUE且大小、块指针都未变时只写数据块
+ * @return int
+ */
+int newfs_fsync_inode(struct newfs_inode * inode, boolean datasync) {
+    struct newfs_dentry* dentry;
+    struct newfs_dentry* cursor;
+    struct newfs_inode*  dir;
+    boolean is_meta = !datasync || NEWFS_IS_DIR(inode) || (inode->flags & NEWFS_FLAG_INODE_BLOCKS);
 
+    if (newfs_fsync_one(inode, is_meta) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (!is_meta) {
+        return NEWFS_ERROR_NONE;
+    }
+    if (newfs_super.is_journal) {
+        return newfs_journal_commit();
+    }
+    if (newfs_fsync_alloc(inode) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    /* 自底向上写回每个名字所在的目录项块，新建的目录连同其inode记录和分配信息一起写回 */
+    for (dentry = inode->dentry; dentry != NULL; dentry = dentry->alias) {
+        for (cursor = dentry; cursor->parent != NULL; cursor = cursor->parent) {
+            dir = cursor->parent->inode;
+            if (dir->flags & (NEWFS_FLAG_INODE_DIRTY | NEWFS_FLAG_INODE_LAZY)) {
+                if (newfs_fsync_dents(dir) != NEWFS_ERROR_NONE || newfs_sync_inode(dir) != NEWFS_ERROR_NONE) {
+                    return -NEWFS_ERROR_IO;
+                }
+            }
+            if (newfs_bsync(dir->block_pointer[cursor->dblk]) != NEWFS_ERROR_NONE ||
+                newfs_bsync(NEWFS_ITAB_DNO(newfs_super.imap, dir->ino)) != NEWFS_ERROR_NONE ||
+                newfs_fsync_alloc(dir) != NEWFS_ERROR_NONE) {
+                return -NEWFS_ERROR_IO;
+            }
+        }
+    }
+    return NEWFS_ERROR_NONE;
+}
 /**
  * @brief 
  * 
@@ -272,63 +1127,108 @@ int newfs_sync_inode(struct newfs_inode * inode) {
  * @return struct newfs_inode* 
  */
 struct newfs_inode* newfs_read_inode(struct newfs_dentry * dentry, int ino) {
-    struct newfs_inode* inode = (struct newfs_inode*)malloc(sizeof(struct newfs_inode));
-    struct newfs_inode_d inode_d;
+    struct newfs_inode* inode;
+    struct newfs_inode_d2 inode_d;
     struct newfs_dentry* sub_dentry;
-    struct newfs_dentry_d dentry_d;
-    int    dir_cnt = 0, i;
+    struct newfs_dentry_d* dentry_d;
+    uint8_t* data;
+    int    blk, ofs;
+
+    int*   imap = dentry->snap != NULL ? dentry->snap->imap : newfs_super.imap;
 
-    if (newfs_driver_read(NEWFS_INO_OFS(ino/16) + ino%16*sizeof(struct newfs_inode_d), (uint8_t *)&inode_d, 
-                        sizeof(struct newfs_inode_d)) != NEWFS_ERROR_NONE) {
+    inode = newfs_icache_find(dentry->snap, ino);
+    if (inode != NULL) {                    /* 硬链接的另一个名字，inode只载入一次 */
+        newfs_icache_attach(inode, dentry);
+        return inode;
+    }
+    data = newfs_bread(NEWFS_ITAB_DNO(imap, ino), FALSE);  /* 同一块中的兄弟inode随后命中缓存 */
+    if (data == NULL) {
         NEWFS_DBG("[%s] io error\n", __func__);
         return NULL;                    
     }
+    if (newfs_inode_decode(data, ino, &inode_d) != NEWFS_ERROR_NONE) {
+        NEWFS_DBG("[%s] ino %d checksum mismatch\n", __func__, ino);
+        return NULL;
+    }
+    inode = newfs_icache_alloc();
+    if (inode == NULL) {
+        return NULL;
+    }
 
     inode->dir_cnt = 0;
     inode->ino = inode_d.ino;
     inode->size = inode_d.size;
+    inode->link = inode_d.link;
+    inode->mode = inode_d.mode;
+    inode->uid  = inode_d.uid;
+    inode->gid  = inode_d.gid;
+    inode->atime.tv_sec  = inode_d.atime_sec;
+    inode->atime.tv_nsec = inode_d.atime_nsec;
+    inode->mtime.tv_sec  = inode_d.mtime_sec;
+    inode->mtime.tv_nsec = inode_d.mtime_nsec;
+    inode->ctime.tv_sec  = inode_d.ctime_sec;
+    inode->ctime.tv_nsec = inode_d.ctime_nsec;
     inode->dentry = dentry;
     inode->dentrys = NULL;
+    inode->dhash    = NULL;
+    inode->dhash_sz = 0;
+    inode->dirty_dents = NULL;
+    inode->names    = NULL;
+    inode->names_dead = 0;
+    inode->cursors  = NULL;
+    inode->gen      = 0;
     for(int i = 0; i < NEWFS_DATA_PER_FILE; i++){
         inode->block_pointer[i] = inode_d.block_pointer[i];
     }
+    inode->frag_blk = inode_d.frag_blk;
+    inode->frag_ofs = inode_d.frag_ofs;
+    inode->frag_len = inode_d.frag_len;
+    inode->zlen     = inode_d.zlen;
 
-    if (NEWFS_IS_DIR(inode)) {
-        dir_cnt = inode_d.dir_cnt;
-        int blk_number = 0;
-        int offset;
-
-        while(dir_cnt > 0 && blk_number < NEWFS_DATA_PER_FILE){
-            offset = NEWFS_DATA_OFS(inode->block_pointer[blk_number]);
-
-            while((dir_cnt > 0) && (offset + sizeof(struct newfs_dentry_d) < NEWFS_DATA_OFS(inode->block_pointer[blk_number] + 1))){
-                if (newfs_driver_read(offset, (uint8_t *)&dentry_d, sizeof(struct newfs_dentry_d)) != NEWFS_ERROR_NONE){
-                    NEWFS_DBG("[%s] io error\n", __func__);
-                    return NULL;  
-                }
-                
-                sub_dentry = new_dentry(dentry_d.fname, dentry_d.ftype);
-                sub_dentry->parent = inode->dentry;
-                sub_dentry->ino    = dentry_d.ino; 
-                newfs_alloc_dentry(inode, sub_dentry);
-
-                offset += sizeof(struct newfs_dentry_d);
-                dir_cnt--;
-            }
-            blk_number++;
-        }
-    }
-    else if (NEWFS_IS_REG(inode)) {
-        for (int i = 0; i < inode->size/NEWFS_BLK_SZ(); i++){
-            inode->data[i] = (uint8_t *)malloc(NEWFS_BLK_SZ());
-            if (newfs_driver_read(NEWFS_DATA_OFS(inode->block_pointer[i]), (uint8_t *)inode->data[i],
-                                NEWFS_BLK_SZ()) != NEWFS_ERROR_NONE) {
+    if (NEWFS_IS_DIR(inode)) {              /* 目录块经块缓存整块读入，逐项解析 */
+        for (blk = 0; blk < NEWFS_DATA_PER_FILE && inode->block_pointer[blk] != NEWFS_NULL_BLK; blk++) {
+            data = newfs_bread(inode->block_pointer[blk], FALSE);
+            if (data == NULL) {
                 NEWFS_DBG("[%s] io error\n", __func__);
-                return NULL;                    
+                newfs_icache_drop(inode);
+                return NULL;
+            }
+            for (ofs = 0; ofs < NEWFS_BLK_SZ(); ofs += NEWFS_REC_LEN(dentry_d)) {
+                dentry_d = (struct newfs_dentry_d*)(data + ofs);
+                if (ofs + NEWFS_REC_LEN(dentry_d) > NEWFS_BLK_SZ() ||
+                    NEWFS_REC_LEN(dentry_d) < NEWFS_DIRENT_LEN(dentry_d->name_len)) {
+                    NEWFS_DBG("[%s] bad dentry at block %d offset %d\n", __func__, blk, ofs);
+                    newfs_icache_drop(inode);
+                    return NULL;
+                }
+                if (dentry_d->name_len == 0) {
+                    continue;
+                }
+                sub_dentry = new_dentry(NULL, (NEWFS_FILE_TYPE)dentry_d->ftype);
+                if (sub_dentry == NULL ||
+                    newfs_name_intern(inode, sub_dentry, dentry_d->name, dentry_d->name_len) != NEWFS_ERROR_NONE) {
+                    newfs_free_dentry(sub_dentry);
+                    newfs_icache_drop(inode);
+                    return NULL;
+                }
+                sub_dentry->parent  = inode->dentry;
+                sub_dentry->snap    = dentry->snap;
+                sub_dentry->ino     = dentry_d->ino; 
+                sub_dentry->hash    = dentry_d->hash;
+                sub_dentry->dblk    = (uint8_t)blk;
+                sub_dentry->dofs    = (uint16_t)ofs;
+                sub_dentry->brother = inode->dentrys;
+                inode->dentrys      = sub_dentry;
+                if (newfs_dhash_add(inode, sub_dentry) != NEWFS_ERROR_NONE) {
+                    newfs_icache_drop(inode);
+                    return NULL;
+                }
+                inode->dir_cnt++;
             }
         }
     }
-
+    /* 普通文件的数据按需经块缓存读取，这里只加载元数据 */
+    newfs_icache_add(inode);
     return inode;
 }
 /**
@@ -353,25 +1253,23 @@ struct newfs_dentry* newfs_get_dentry(struct newfs_inode * inode, int dir) {
 }
 /**
  * @brief 查找文件或目录
- * path: /qwe/ad  total_lvl = 2,
- *      1) find /'s inode       lvl = 1
+ * 用newfs_path_next在原路径上逐个取分量(指针, 长度)，单遍扫描、不分配内存，名字按长度精确匹配
+ * path: /qwe/ad
+ *      1) find /'s inode
  *      2) find qwe's dentry 
- *      3) find qwe's inode     lvl = 2
- *      4) find ad's dentry
- *
- * path: /qwe     total_lvl = 1,
- *      1) find /'s inode       lvl = 1
- *      2) find qwe's dentry
- *  
+ *      3) find qwe's inode
+ *      4) find ad's dentry     ad之后没有分量，is_find=TRUE
  * 
  * 如果能查找到，返回该目录项
  * 如果查找不到，返回的是上一个有效的路径
  * 
  * path: /a/b/c
- *      1) find /'s inode     lvl = 1
+ *      1) find /'s inode
  *      2) find a's dentry 
- *      3) find a's inode     lvl = 2
+ *      3) find a's inode
  *      4) find b's dentry    如果此时找不到了，is_find=FALSE且返回的是a的inode对应的dentry
+ * 路径中间的分量是普通文件时返回该文件，is_find=FALSE
+ * 途经的inode读不出(IO错误或校验和不符)时返回NULL，调用者返回-NEWFS_ERROR_IO
  * 
  * @param path 
  * @return struct newfs_dentry* 
@@ -380,76 +1278,109 @@ struct newfs_dentry* newfs_lookup(const char * path, boolean* is_find, boolean*
     struct newfs_dentry* dentry_cursor = newfs_super.root_dentry;
     struct newfs_dentry* dentry_ret = NULL;
     struct newfs_inode*  inode; 
-    int   total_lvl = newfs_calc_lvl(path);
-    int   lvl = 0;
-    boolean is_hit;
-    char* fname = NULL;
-    char* path_cpy = (char*)malloc(sizeof(path));
+    int         path_len = strlen(path);
+    const char* fname;
+    const char* next;
+    int         len, next_len;
+    boolean     is_miss = FALSE;
+    *is_find = FALSE;
     *is_root = FALSE;
-    strcpy(path_cpy, path);
 
-    if (total_lvl == 0) {                           /* 根目录 */
+    newfs_journal_tick();                           /* 上一次调用已完整，可以作为组提交的边界 */
+    newfs_icache_shrink();                          /* 上一次调用用过的inode此时才可能被淘汰 */
+    dentry_ret = newfs_pcache_find(path, path_len, is_find);
+    if (dentry_ret != NULL) {                       /* 整条路径命中(包括确定不存在)，不再逐级查找 */
+        if (dentry_ret->inode == NULL) {
+            dentry_ret->inode = newfs_read_inode(dentry_ret, dentry_ret->ino);
+            if (dentry_ret->inode == NULL) {
+                *is_find = FALSE;
+                return NULL;
+            }
+        }
+        newfs_icache_touch(dentry_ret->inode);
+        return dentry_ret;
+    }
+
+    fname = newfs_path_next(path, &len);
+    if (fname == NULL) {                            /* 根目录 */
         *is_find = TRUE;
         *is_root = TRUE;
         dentry_ret = newfs_super.root_dentry;
     }
-    fname = strtok(path_cpy, "/");       
     while (fname)
     {   
-        lvl++;
+        next = newfs_path_next(fname + len, &next_len);
         if (dentry_cursor->inode == NULL) {           /* Cache机制 */
-            newfs_read_inode(dentry_cursor, dentry_cursor->ino);
+            dentry_cursor->inode = newfs_read_inode(dentry_cursor, dentry_cursor->ino);
+            if (dentry_cursor->inode == NULL) {
+                return NULL;
+            }
         }
 
         inode = dentry_cursor->inode;
+        newfs_icache_touch(inode);
 
-        if (NEWFS_IS_REG(inode) && lvl < total_lvl) {
+        if (NEWFS_IS_REG(inode)) {                  /* 还有分量，但当前不是目录 */
             NEWFS_DBG("[%s] not a dir\n", __func__);
             dentry_ret = inode->dentry;
             break;
         }
-        if (NEWFS_IS_DIR(inode)) {
-            dentry_cursor = inode->dentrys;
-            is_hit        = FALSE;
-
-            while (dentry_cursor)   /* 遍历子目录项 */
-            {
-                if (memcmp(dentry_cursor->fname, fname, strlen(fname)) == 0) {
-                    is_hit = TRUE;
-                    break;
-                }
-                dentry_cursor = dentry_cursor->brother;
-            }
-            
-            if (!is_hit) {
-                *is_find = FALSE;
-                NEWFS_DBG("[%s] not found %s\n", __func__, fname);
-                dentry_ret = inode->dentry;
-                break;
-            }
+        if (inode == newfs_super.root_dentry->inode && len == sizeof(NEWFS_SNAP_DIR) - 1 &&
+            memcmp(fname, NEWFS_SNAP_DIR, len) == 0) {
+            dentry_cursor = newfs_super.snap_dentry;    /* 隐藏的快照目录 */
+        }
+        else {
+            dentry_cursor = newfs_dhash_find(inode, fname, len);
+        }
 
-            if (is_hit && lvl == total_lvl) {
-                *is_find = TRUE;
-                dentry_ret = dentry_cursor;
-                break;
-            }
+        if (dentry_cursor == NULL) {                /* 未命中很常见，不打印 */
+            dentry_ret = inode->dentry;
+            is_miss    = TRUE;
+            break;
         }
-        fname = strtok(NULL, "/"); 
+        if (next == NULL) {
+            *is_find = TRUE;
+            dentry_ret = dentry_cursor;
+            break;
+        }
+        fname = next;
+        len   = next_len;
     }
 
     if (dentry_ret->inode == NULL) {
         dentry_ret->inode = newfs_read_inode(dentry_ret, dentry_ret->ino);
+        if (dentry_ret->inode == NULL) {
+            *is_find = FALSE;
+            *is_root = FALSE;
+            return NULL;
+        }
+    }
+    newfs_icache_touch(dentry_ret->inode);
+    if ((*is_find && !*is_root) || is_miss) {
+        newfs_pcache_add(path, path_len, dentry_ret, *is_find);
     }
-    
     return dentry_ret;
 }
 /**
- * @brief 挂载newfs
+ * @brief 块大小是否合法：2的幂，介于NEWFS_MIN_BLK_SZ与NEWFS_MAX_BLK_SZ之间，且为IO大小的整数倍
  * 
+ * @param sz_blks 
+ * @return boolean 
+ */
+static boolean newfs_blksz_valid(int sz_blks) {
+    return sz_blks >= NEWFS_MIN_BLK_SZ && sz_blks <= NEWFS_MAX_BLK_SZ &&
+           (sz_blks & (sz_blks - 1)) == 0 && sz_blks % NEWFS_IO_SZ() == 0;
+}
+/**
+ * @brief 挂载newfs
  * 
- * IO_SZ = BLK_SZ/2
+ * Layout
+ * | Super | Inode Map | Data Map | Journal | Inode | Data |
  * 
- * 每个Inode占用一个Blk
+ * BLK_SZ在格式化时由--blksz选定(默认1KiB)并写入超级块，与IO_SZ无关，
+ * 各区大小按磁盘块数计算，索引节点区预分配1/NEWFS_INODE_RATIO，
+ * 用完后新的inode表块从数据区分配并记录在imap中，inode数上限由inode位图决定
+ * 日志区占1/NEWFS_JOURNAL_RATIO，挂载时先重放日志再读位图
  * @param options 
  * @return int 
  */
@@ -461,12 +1392,16 @@ int newfs_mount(struct custom_options options){
     struct newfs_inode*   root_inode;
 
     int                 inode_num;
+    int                 inode_blks;
     int                 map_inode_blks;
     
     int                 data_num;
     int                 map_data_blks;
 
     int                 super_blks;
+    int                 journal_blks;
+    int                 total_blks;
+    int                 cache_blks;
     boolean             is_init = FALSE;
 
     newfs_super.is_mounted = FALSE;
@@ -481,7 +1416,6 @@ int newfs_mount(struct custom_options options){
     newfs_super.fd = driver_fd;
     ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_SIZE,  &newfs_super.sz_disk);
     ddriver_ioctl(NEWFS_DRIVER(), IOC_REQ_DEVICE_IO_SZ, &newfs_super.sz_io);
-    newfs_super.sz_blks = 2 * newfs_super.sz_io;
     root_dentry = new_dentry("/", NEWFS_DIR);     /* 根目录项每次挂载时新建 */
     /* 读取super */
     if (newfs_driver_read(NEWFS_SUPER_OFS, (uint8_t *)(&newfs_super_d), 
@@ -489,16 +1423,29 @@ int newfs_mount(struct custom_options options){
         return -NEWFS_ERROR_IO;
     }   
 
+    if (newfs_super_d.magic_num == NEWFS_MAGIC_NUM && 
+        !newfs_blksz_valid(newfs_super_d.sz_blks)) {     /* 旧格式(sz_blks为0)或超级块损坏，拒绝挂载，不能格式化 */
+        NEWFS_DBG("[%s] unsupported block size %d on formatted device\n", __func__, newfs_super_d.sz_blks);
+        ddriver_close(driver_fd);
+        return -NEWFS_ERROR_INVAL;
+    }
     if (newfs_super_d.magic_num != NEWFS_MAGIC_NUM) {     /* 幻数不正确，初始化 */
+        /* 块大小在格式化时选定并记录在超级块中 */
+        newfs_super.sz_blks = options.blksz != 0 ? options.blksz : NEWFS_DEFAULT_BLK_SZ;
+        if (!newfs_blksz_valid(newfs_super.sz_blks)) {
+            NEWFS_DBG("[%s] invalid block size %d\n", __func__, newfs_super.sz_blks);
+            return -NEWFS_ERROR_INVAL;
+        }
         /* 估算各部分大小 */
         super_blks = NEWFS_SUPER_BLKS;
-        map_inode_blks = NEWFS_MAP_INODE_BLKS;
-        map_data_blks = NEWFS_MAP_DATA_BLKS;
-        inode_num  = NEWFS_INODE_BLKS;
-        data_num = NEWFS_DATA_BLKS;
-
-        newfs_super.max_ino = inode_num;
-        newfs_super.max_data = data_num;
+        total_blks = NEWFS_DISK_SZ() / NEWFS_BLK_SZ();
+        inode_blks = NEWFS_ROUND_UP(total_blks, NEWFS_INODE_RATIO) / NEWFS_INODE_RATIO;
+        map_inode_blks = NEWFS_MAP_INODE_BLKS;            /* inode数只受位图限制，超出inode区的表块按需分配 */
+        inode_num  = NEWFS_BLKS_SZ(map_inode_blks) * UINT8_BITS;
+        map_data_blks = NEWFS_ROUND_UP(total_blks, NEWFS_BLKS_SZ(UINT8_BITS)) / NEWFS_BLKS_SZ(UINT8_BITS);
+        journal_blks = total_blks / NEWFS_JOURNAL_RATIO;
+        journal_blks = journal_blks < NEWFS_JOURNAL_MIN_BLKS ? 0 : journal_blks;
+        data_num = total_blks - super_blks - map_inode_blks - map_data_blks - journal_blks - inode_blks;
 
         newfs_super_d.map_inode_blks = map_inode_blks; 
         newfs_super_d.map_data_blks = map_data_blks; 
@@ -506,15 +1453,34 @@ int newfs_mount(struct custom_options options){
         newfs_super_d.map_inode_offset = NEWFS_SUPER_OFS + NEWFS_BLKS_SZ(super_blks);
         newfs_super_d.map_data_offset = newfs_super_d.map_inode_offset + NEWFS_BLKS_SZ(map_inode_blks);
 
-        newfs_super_d.inode_offset = newfs_super_d.map_data_offset + NEWFS_BLKS_SZ(map_data_blks);
-        newfs_super_d.data_offset = newfs_super_d.inode_offset + NEWFS_BLKS_SZ(inode_num);
+        newfs_super_d.journal_offset = newfs_super_d.map_data_offset + NEWFS_BLKS_SZ(map_data_blks);
+        newfs_super_d.journal_blks = journal_blks;
+        newfs_super_d.inode_offset = newfs_super_d.journal_offset + NEWFS_BLKS_SZ(journal_blks);
+        newfs_super_d.data_offset = newfs_super_d.inode_offset + NEWFS_BLKS_SZ(inode_blks);
 
+        newfs_super_d.sz_blks  = NEWFS_BLK_SZ();
+        newfs_super_d.max_ino  = inode_num;
+        newfs_super_d.max_data = data_num;
+        newfs_super_d.frag_head = NEWFS_NULL_BLK;
+        newfs_super_d.features  = NEWFS_FEATURE_INODE_V2 | (journal_blks > 0 ? NEWFS_FEATURE_JOURNAL : 0);
+        newfs_super_d.snap_cnt  = 0;
+        newfs_super_d.snap_blk  = NEWFS_NULL_BLK;
+        newfs_super_d.imap_dno  = NEWFS_NULL_BLK;
         newfs_super_d.sz_usage = 0;
         newfs_super_d.magic_num = NEWFS_MAGIC_NUM;
 
         is_init = TRUE;
     }
+    else if ((newfs_super_d.features & NEWFS_FEATURE_JOURNAL) &&
+             newfs_journal_replay(&newfs_super_d) < 0) {     /* 重放可能改写超级块，之后的字段以重放后为准 */
+        return -NEWFS_ERROR_IO;
+    }
+    newfs_super.sz_blks    = newfs_super_d.sz_blks;
+    newfs_super.sz_inode   = (newfs_super_d.features & NEWFS_FEATURE_INODE_V2) ?
+                             sizeof(struct newfs_inode_d2) : sizeof(struct newfs_inode_d);
     newfs_super.sz_usage   = newfs_super_d.sz_usage;      /* 建立 in-memory 结构 */
+    newfs_super.max_ino    = newfs_super_d.max_ino;
+    newfs_super.max_data   = newfs_super_d.max_data;
     
     newfs_super.map_inode = (uint8_t *)malloc(NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks));
     newfs_super.map_inode_blks = newfs_super_d.map_inode_blks;
@@ -524,27 +1490,107 @@ int newfs_mount(struct custom_options options){
     newfs_super.map_data_blks = newfs_super_d.map_data_blks;
     newfs_super.map_data_offset = newfs_super_d.map_data_offset;
     newfs_super.data_offset = newfs_super_d.data_offset;
+    newfs_super.is_tailpack = options.tailpack;
+    newfs_super.is_compress = options.compress;
+    newfs_super.is_dedup    = options.dedup;
+    newfs_super.atime_policy = options.atime;
+    newfs_super.features    = newfs_super_d.features | (options.dedup ? NEWFS_FEATURE_DEDUP : 0);
+    newfs_super.is_journal  = FALSE;
+    if (newfs_super.features & NEWFS_FEATURE_JOURNAL) {
+        newfs_super.journal_offset = newfs_super_d.journal_offset;
+        newfs_super.journal_blks   = newfs_super_d.journal_blks;
+    }
 
-    if (newfs_driver_read(newfs_super_d.map_inode_offset, (uint8_t *)(newfs_super.map_inode), 
-                        NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks)) != NEWFS_ERROR_NONE) {
-        return -NEWFS_ERROR_IO;
+    if (is_init) {                                        /* 新格式化的磁盘位图全空 */
+        memset(newfs_super.map_inode, 0, NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks));
+        memset(newfs_super.map_data, 0, NEWFS_BLKS_SZ(newfs_super_d.map_data_blks));
     }
-    if (newfs_driver_read(newfs_super_d.map_data_offset, (uint8_t *)(newfs_super.map_data), 
+    else if (newfs_driver_read(newfs_super_d.map_inode_offset, (uint8_t *)(newfs_super.map_inode), 
+                        NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks)) != NEWFS_ERROR_NONE ||
+             newfs_driver_read(newfs_super_d.map_data_offset, (uint8_t *)(newfs_super.map_data), 
                         NEWFS_BLKS_SZ(newfs_super_d.map_data_blks)) != NEWFS_ERROR_NONE) {
         return -NEWFS_ERROR_IO;
     }
+    cache_blks = NEWFS_CACHE_SZ / NEWFS_BLK_SZ();
+    cache_blks = cache_blks > NEWFS_CACHE_MIN_BLKS ? cache_blks : NEWFS_CACHE_MIN_BLKS;
+    if (newfs_cache_init(cache_blks) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    if (newfs_snap_init(&newfs_super_d, root_dentry) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (newfs_journal_init(cache_blks, &newfs_super_d) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    if (newfs_frag_init(newfs_super_d.frag_head) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (newfs_zip_init() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    if (newfs_dedup_init(newfs_super.is_dedup, 
+                         (newfs_super_d.features & NEWFS_FEATURE_DEDUP) != 0) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (newfs_pcache_init() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
     if (is_init) {
         root_inode = newfs_alloc_inode(root_dentry);
         newfs_sync_inode(root_inode);
+        if (newfs_super.is_journal) {                     /* 超级块和根目录先落盘，此后崩溃可经日志恢复 */
+            if (newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d,
+                                   sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE ||
+                newfs_journal_checkpoint() != NEWFS_ERROR_NONE) {
+                return -NEWFS_ERROR_IO;
+            }
+        }
+        else if (newfs_bflush() != NEWFS_ERROR_NONE ||    /* fsync只补写增量，格式本身须先落盘 */
+                 newfs_driver_write(newfs_super_d.map_inode_offset, newfs_super.map_inode,
+                                    NEWFS_BLKS_SZ(newfs_super_d.map_inode_blks)) != NEWFS_ERROR_NONE ||
+                 newfs_driver_write(newfs_super_d.map_data_offset, newfs_super.map_data,
+                                    NEWFS_BLKS_SZ(newfs_super_d.map_data_blks)) != NEWFS_ERROR_NONE ||
+                 newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d,
+                                    sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
+            return -NEWFS_ERROR_IO;
+        }
+    }
+    else {
+        root_inode = newfs_read_inode(root_dentry, NEWFS_ROOT_INO);
+    }
+    if (root_inode == NULL) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (!newfs_super.is_journal) {                        /* 此时内存中的位图与磁盘一致 */
+        map_inode_disk = (uint8_t *)malloc(NEWFS_BLKS_SZ(newfs_super.map_inode_blks));
+        map_data_disk  = (uint8_t *)malloc(NEWFS_BLKS_SZ(newfs_super.map_data_blks));
+        if (map_inode_disk == NULL || map_data_disk == NULL) {
+            return -NEWFS_ERROR_NOSPACE;
+        }
+        memcpy(map_inode_disk, newfs_super.map_inode, NEWFS_BLKS_SZ(newfs_super.map_inode_blks));
+        memcpy(map_data_disk, newfs_super.map_data, NEWFS_BLKS_SZ(newfs_super.map_data_blks));
     }
-    
-    root_inode            = newfs_read_inode(root_dentry, NEWFS_ROOT_INO);
     root_dentry->inode    = root_inode;
+    newfs_iget(root_inode);                               /* 根目录常驻 */
     newfs_super.root_dentry = root_dentry;
     newfs_super.is_mounted  = TRUE;
 
     return ret;
 }
+/**
+ * @brief 检查点: 把脏inode、碎片块链表和块缓存中的脏块写回磁盘，启用日志时元数据经日志提交后写回
+ * 
+ * @return int 
+ */
+int newfs_checkpoint() {
+    if (newfs_icache_sync() != NEWFS_ERROR_NONE ||
+        newfs_frag_sync() < NEWFS_NULL_BLK ||
+        newfs_bflush() != NEWFS_ERROR_NONE ||
+        newfs_journal_checkpoint() != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    return NEWFS_ERROR_NONE;
+}
 /**
  * @brief 
  * 
@@ -557,7 +1603,20 @@ int newfs_umount() {
         return NEWFS_ERROR_NONE;
     }
 
-    newfs_sync_inode(newfs_super.root_dentry->inode);     
+    newfs_icache_sync();                                  /* 只写回脏inode */
+    newfs_super_d.frag_head = newfs_frag_sync();          /* 启用日志时碎片块随元数据提交 */
+    if (newfs_super_d.frag_head < NEWFS_NULL_BLK) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (newfs_bflush() != NEWFS_ERROR_NONE) {             /* 写回文件数据 */
+        return -NEWFS_ERROR_IO;
+    }
+    if (newfs_snap_sync(&newfs_super_d) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (newfs_journal_checkpoint() != NEWFS_ERROR_NONE) { /* 提交并写回剩余的元数据，清空日志 */
+        return -NEWFS_ERROR_IO;
+    }
                                  
     newfs_super_d.magic_num           = NEWFS_MAGIC_NUM;
     newfs_super_d.sz_usage            = newfs_super.sz_usage;
@@ -570,6 +1629,13 @@ int newfs_umount() {
     newfs_super_d.map_data_offset     = newfs_super.map_data_offset;
     newfs_super_d.data_offset         = newfs_super.data_offset;
 
+    newfs_super_d.sz_blks             = newfs_super.sz_blks;
+    newfs_super_d.max_ino             = newfs_super.max_ino;
+    newfs_super_d.max_data            = newfs_super.max_data;
+    newfs_super_d.features            = newfs_super.features;
+    newfs_super_d.journal_offset      = newfs_super.journal_offset;
+    newfs_super_d.journal_blks        = newfs_super.journal_blks;
+
     if (newfs_driver_write(NEWFS_SUPER_OFS, (uint8_t *)&newfs_super_d, 
                      sizeof(struct newfs_super_d)) != NEWFS_ERROR_NONE) {
         return -NEWFS_ERROR_IO;
@@ -587,6 +1653,19 @@ int newfs_umount() {
 
     free(newfs_super.map_inode);
     free(newfs_super.map_data);
+    free(map_inode_disk);
+    free(map_data_disk);
+    map_inode_disk = NULL;
+    map_data_disk  = NULL;
+    newfs_journal_destroy();
+    newfs_frag_destroy();
+    newfs_zip_destroy();
+    newfs_dedup_destroy();
+    newfs_snap_destroy();
+    newfs_pcache_destroy();
+    newfs_icache_destroy();
+    newfs_cache_destroy();
+    newfs_slab_destroy(&dentry_slab);                     /* 所有内存dentry一并释放 */
 
     ddriver_close(NEWFS_DRIVER());
     
@@ -0,0 +1,372 @@
+#include "../include/newfs.h"
+
+extern struct newfs_super      newfs_super;
+
+/******************************************************************************
+* SECTION: LZ压缩编码
+* LZ4风格的块格式: 每个序列为 token | [字面量长度扩展] | 字面量 | 偏移(2B) | [匹配长度扩展]，
+* token高4位为字面量长度，低4位为匹配长度-NEWFS_LZ_MINMATCH，值为15时后续字节累加(255表示继续)。
+* 最后一个序列只有字面量。
+*******************************************************************************/
+#define NEWFS_LZ_MINMATCH       4
+#define NEWFS_LZ_HASH_BITS      12
+#define NEWFS_LZ_MAX_OFS        65535
+
+static int lz_table[1 << NEWFS_LZ_HASH_BITS];
+
+static inline uint32_t newfs_lz_read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline int newfs_lz_hash(uint32_t v) {
+    return (v * 2654435761U) >> (32 - NEWFS_LZ_HASH_BITS);
+}
+
+static inline int newfs_lz_put_len(uint8_t* dst, int op, int len) {
+    for (; len >= 255; len -= 255) {
+        dst[op++] = 255;
+    }
+    dst[op++] = len;
+    return op;
+}
+
+/**
+ * @brief 输出一个序列，mlen为0表示最后一个只有字面量的序列
+ *
+ * @return int 新的输出位置，空间不足返回-1
+ */
+static int newfs_lz_emit(uint8_t* dst, int op, int cap, const uint8_t* lit, int lit_len,
+                         int ofs, int mlen) {
+    int ml = mlen > 0 ? mlen - NEWFS_LZ_MINMATCH : 0;
+
+    if (op + 1 + lit_len / 255 + 1 + lit_len + 2 + ml / 255 + 1 > cap) {
+        return -1;
+    }
+    dst[op++] = ((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15);
+    if (lit_len >= 15) {
+        op = newfs_lz_put_len(dst, op, lit_len - 15);
+    }
+    memcpy(dst + op, lit, lit_len);
+    op += lit_len;
+    if (mlen > 0) {
+        dst[op++] = ofs & 0xFF;
+        dst[op++] = ofs >> 8;
+        if (ml >= 15) {
+            op = newfs_lz_put_len(dst, op, ml - 15);
+        }
+    }
+    return op;
+}
+
+/**
+ * @brief 压缩src[0, n)到dst
+ *
+ * @return int 压缩后长度，超出cap返回0
+ */
+int newfs_lz_compress(const uint8_t* src, int n, uint8_t* dst, int cap) {
+    int      ip = 0, anchor = 0, op = 0, ref, mlen, h;
+    uint32_t v;
+
+    memset(lz_table, 0xFF, sizeof(lz_table));
+    while (ip + NEWFS_LZ_MINMATCH <= n) {
+        v   = newfs_lz_read32(src + ip);
+        h   = newfs_lz_hash(v);
+        ref = lz_table[h];
+        lz_table[h] = ip;
+        if (ref < 0 || ip - ref > NEWFS_LZ_MAX_OFS || newfs_lz_read32(src + ref) != v) {
+            ip++;
+            continue;
+        }
+        mlen = NEWFS_LZ_MINMATCH;
+        while (ip + mlen < n && src[ref + mlen] == src[ip + mlen]) {
+            mlen++;
+        }
+        op = newfs_lz_emit(dst, op, cap, src + anchor, ip - anchor, ip - ref, mlen);
+        if (op < 0) {
+            return 0;
+        }
+        ip    += mlen;
+        anchor = ip;
+    }
+    op = newfs_lz_emit(dst, op, cap, src + anchor, n - anchor, 0, 0);
+    return op < 0 ? 0 : op;
+}
+
+/**
+ * @brief 解压src[0, clen)到dst，输出不超过n字节
+ *
+ * @return int 解压后长度，数据损坏返回-1
+ */
+int newfs_lz_decompress(const uint8_t* src, int clen, uint8_t* dst, int n) {
+    int ip = 0, op = 0, lit, mlen, ofs, b;
+
+    while (ip < clen) {
+        b   = src[ip++];
+        lit = b >> 4;
+        mlen = b & 0xF;
+        if (lit == 15) {
+            do {
+                if (ip >= clen) {
+                    return -1;
+                }
+                b    = src[ip++];
+                lit += b;
+            } while (b == 255);
+        }
+        if (ip + lit > clen || op + lit > n) {
+            return -1;
+        }
+        memcpy(dst + op, src + ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == clen) {                                   /* 最后一个序列 */
+            break;
+        }
+        if (ip + 2 > clen) {
+            return -1;
+        }
+        ofs = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (mlen == 15) {
+            do {
+                if (ip >= clen) {
+                    return -1;
+                }
+                b     = src[ip++];
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += NEWFS_LZ_MINMATCH;
+        if (ofs == 0 || ofs > op || op + mlen > n) {
+            return -1;
+        }
+        for (; mlen > 0; mlen--, op++) {                    /* 匹配可能与输出重叠，逐字节拷贝 */
+            dst[op] = dst[op - ofs];
+        }
+    }
+    return op;
+}
+
+/******************************************************************************
+* SECTION: 透明压缩
+* 以文件的全部逻辑块(最多NEWFS_DATA_PER_FILE块)为一个簇，同步时整体压缩，
+* 压缩结果原地存放在block_pointer[0, ceil(zlen / BLK_SZ))中，其余块释放。
+* 读时解压到单簇解压缓存zbuf，写或截断前先展开回普通块。
+*******************************************************************************/
+static uint8_t*            zbuf;            /* 解压缓存，内容为zbuf_owner的明文 */
+static uint8_t*            zout;            /* 压缩输出/压缩数据暂存 */
+static int                 zout_cap;
+static struct newfs_inode* zbuf_owner;      /* 按inode区分，快照中的文件可能与活动文件同ino */
+
+int newfs_zip_init() {
+    int raw = NEWFS_BLKS_SZ(NEWFS_DATA_PER_FILE);
+
+    zout_cap = raw + raw / 255 + 16;
+    zbuf       = (uint8_t*)malloc(raw);
+    zout       = (uint8_t*)malloc(zout_cap);
+    zbuf_owner = NULL;
+    if (zbuf == NULL || zout == NULL) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+void newfs_zip_destroy() {
+    free(zbuf);
+    free(zout);
+    zbuf       = NULL;
+    zout       = NULL;
+    zbuf_owner = NULL;
+}
+
+/**
+ * @brief inode被淘汰前调用，避免新inode复用同一地址时误用zbuf
+ *
+ * @param inode
+ */
+void newfs_zip_forget(struct newfs_inode* inode) {
+    if (zbuf_owner == inode) {
+        zbuf_owner = NULL;
+    }
+}
+
+/**
+ * @brief 把普通文件(可能含空洞和碎片尾部)的明文读入zbuf
+ *
+ * @param inode
+ * @return int
+ */
+static int newfs_zip_gather(struct newfs_inode* inode) {
+    int      blk, len, dno;
+    uint8_t* data;
+
+    for (blk = 0; NEWFS_BLKS_SZ(blk) < inode->size; blk++) {
+        len = inode->size - NEWFS_BLKS_SZ(blk);
+        len = len < NEWFS_BLK_SZ() ? len : NEWFS_BLK_SZ();
+        if (inode->frag_blk != NEWFS_NULL_BLK && blk == inode->size / NEWFS_BLK_SZ()) {
+            data = newfs_bread(inode->frag_blk, FALSE);
+            if (data == NULL) {
+                return -NEWFS_ERROR_IO;
+            }
+            data += inode->frag_ofs;
+        }
+        else if ((dno = inode->block_pointer[blk]) == NEWFS_NULL_BLK) {
+            memset(zbuf + NEWFS_BLKS_SZ(blk), 0, len);
+            continue;
+        }
+        else if ((data = newfs_bread(dno, FALSE)) == NULL) {
+            return -NEWFS_ERROR_IO;
+        }
+        memcpy(zbuf + NEWFS_BLKS_SZ(blk), data, len);
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 确保block_pointer[0, blks)都已分配且不与其他文件共享，新分配的块清零
+ *
+ * @return int
+ */
+static int newfs_zip_reserve(struct newfs_inode* inode, int blks) {
+    int blk, dno;
+
+    for (blk = 0; blk < blks; blk++) {
+        if (inode->block_pointer[blk] != NEWFS_NULL_BLK) {
+            if (newfs_bunshare(inode, blk, FALSE) < 0) {
+                return -NEWFS_ERROR_NOSPACE;
+            }
+            continue;
+        }
+        dno = newfs_bmap(inode, blk, TRUE);
+        if (dno < 0) {
+            return dno;
+        }
+        if (newfs_bread(dno, TRUE) == NULL) {
+            return -NEWFS_ERROR_IO;
+        }
+        newfs_bdirty(dno);
+    }
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 获取压缩文件的明文，返回的缓冲区在下一次压缩/展开其他文件前有效
+ *
+ * @param inode 已压缩的普通文件
+ * @return uint8_t* 明文，失败返回NULL
+ */
+uint8_t* newfs_zip_load(struct newfs_inode* inode) {
+    int      blk, len, cblks = NEWFS_ROUND_UP(inode->zlen, NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
+    uint8_t* data;
+
+    if (zbuf_owner == inode) {
+        return zbuf;
+    }
+    for (blk = 0; blk < cblks; blk++) {
+        data = newfs_bread(inode->block_pointer[blk], FALSE);
+        if (data == NULL) {
+            return NULL;
+        }
+        len = inode->zlen - NEWFS_BLKS_SZ(blk);
+        memcpy(zout + NEWFS_BLKS_SZ(blk), data, len < NEWFS_BLK_SZ() ? len : NEWFS_BLK_SZ());
+    }
+    zbuf_owner = NULL;
+    if (newfs_lz_decompress(zout, inode->zlen, zbuf, inode->size) != inode->size) {
+        NEWFS_DBG("[%s] corrupt compressed data in ino %d\n", __func__, inode->ino);
+        return NULL;
+    }
+    zbuf_owner = inode;
+    return zbuf;
+}
+
+/**
+ * @brief 压缩普通文件，至少节省一个数据块时才保留压缩结果，在newfs_sync_inode中调用
+ *
+ * @param inode
+ * @return int
+ */
+int newfs_zip_pack(struct newfs_inode* inode) {
+    int      blks = NEWFS_ROUND_UP(inode->size, NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
+    int      blk, cblks, clen, len, dno;
+    uint8_t* data;
+
+    if (inode->zlen > 0 || blks <= 1) {
+        return NEWFS_ERROR_NONE;
+    }
+    zbuf_owner = NULL;
+    if (newfs_zip_gather(inode) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_IO;
+    }
+    clen = newfs_lz_compress(zbuf, inode->size, zout, NEWFS_BLKS_SZ(blks - 1));
+    if (clen == 0) {                                        /* 不可压缩 */
+        return NEWFS_ERROR_NONE;
+    }
+    cblks = NEWFS_ROUND_UP(clen, NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
+    if (newfs_zip_reserve(inode, cblks) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+
+    for (blk = 0; blk < cblks; blk++) {
+        dno  = inode->block_pointer[blk];
+        data = newfs_bread(dno, TRUE);
+        if (data == NULL) {
+            return -NEWFS_ERROR_IO;
+        }
+        len = clen - NEWFS_BLKS_SZ(blk);
+        memcpy(data, zout + NEWFS_BLKS_SZ(blk), len < NEWFS_BLK_SZ() ? len : NEWFS_BLK_SZ());
+        newfs_bdirty(dno);
+    }
+    for (; blk < NEWFS_DATA_PER_FILE; blk++) {
+        if (inode->block_pointer[blk] != NEWFS_NULL_BLK) {
+            newfs_free_data(inode->block_pointer[blk]);
+            inode->block_pointer[blk] = NEWFS_NULL_BLK;
+        }
+    }
+    if (inode->frag_blk != NEWFS_NULL_BLK) {
+        newfs_frag_free(inode->frag_blk, inode->frag_ofs, inode->frag_len);
+        inode->frag_blk = NEWFS_NULL_BLK;
+        inode->frag_ofs = 0;
+        inode->frag_len = 0;
+    }
+    inode->zlen = clen;
+    zbuf_owner  = inode;                                    /* zbuf中正是该文件的明文 */
+    return NEWFS_ERROR_NONE;
+}
+
+/**
+ * @brief 把压缩文件展开回普通块，在写或截断之前调用
+ *
+ * @param inode
+ * @return int
+ */
+int newfs_zip_unpack(struct newfs_inode* inode) {
+    int      blks = NEWFS_ROUND_UP(inode->size, NEWFS_BLK_SZ()) / NEWFS_BLK_SZ();
+    int      blk, len, dno;
+    uint8_t* data;
+
+    if (inode->zlen == 0) {
+        return NEWFS_ERROR_NONE;
+    }
+    if (newfs_zip_load(inode) == NULL) {
+        return -NEWFS_ERROR_IO;
+    }
+    if (newfs_zip_reserve(inode, blks) != NEWFS_ERROR_NONE) {
+        return -NEWFS_ERROR_NOSPACE;
+    }
+    for (blk = 0; blk < blks; blk++) {
+        dno  = inode->block_pointer[blk];
+        data = newfs_bread(dno, TRUE);
+        if (data == NULL) {
+            return -NEWFS_ERROR_IO;
+        }
+        len = inode->size - NEWFS_BLKS_SZ(blk);
+        memcpy(data, zbuf + NEWFS_BLKS_SZ(blk), len < NEWFS_BLK_SZ() ? len : NEWFS_BLK_SZ());
+        newfs_bdirty(dno);
+    }
+    inode->zlen = 0;
+    zbuf_owner  = NULL;
+    newfs_inode_dirty_blocks(inode);
+    return NEWFS_ERROR_NONE;
+}
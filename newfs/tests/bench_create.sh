@@ -0,0 +1,49 @@
+#!/bin/bash
+# 单目录大量创建与查找的耗时测试
+# 用法: ./bench_create.sh [文件数]
+# 目录最多NEWFS_DATA_PER_FILE个数据块，以64KiB块格式化时单个目录可容纳约一万个短名目录项，
+# inode表按需扩展，超过目录容量的创建会返回ENOSPC，此时以实际创建数为准
+
+WORK_DIR=$(cd "$(dirname "$0")"; pwd)
+cd "$WORK_DIR" || exit
+
+MNTPOINT='./mnt'
+PROJECT_NAME="newfs"
+COUNT=${1:-5000}
+
+function mount_fuse() {
+    ../build/${PROJECT_NAME} --device="$HOME"/ddriver --blksz=65536 ${MNTPOINT}
+}
+
+function elapsed_ms() {
+    echo $(( ($(date +%s%N) - $1) / 1000000 ))
+}
+
+mkdir -p ${MNTPOINT}
+ddriver -r > /dev/null                                  # 重置磁盘，使--blksz生效
+if ! mount_fuse; then
+    echo "mount失败"
+    exit 1
+fi
+mkdir ${MNTPOINT}/bench
+
+START=$(date +%s%N)
+CREATED=0
+for ((i = 0; i < COUNT; i++)); do
+    if ! touch ${MNTPOINT}/bench/file"$i" 2>/dev/null; then
+        break
+    fi
+    CREATED=$((CREATED + 1))
+done
+echo "创建 ${CREATED} 个文件: $(elapsed_ms "$START") ms"
+
+fusermount -u ${MNTPOINT}
+mount_fuse
+
+START=$(date +%s%N)
+for ((i = 0; i < CREATED; i++)); do
+    stat ${MNTPOINT}/bench/file"$i" > /dev/null
+done
+echo "重新挂载后查找 ${CREATED} 个文件: $(elapsed_ms "$START") ms"
+
+fusermount -u ${MNTPOINT}
@@ -3,9 +3,10 @@ POINTS=0
 TOTAL_POINTS=0
 TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh)
 # mount.sh mkdir.sh touch.sh ls.sh remount.sh (read.sh write.sh cp.sh)
-ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
-ALL_TEST_SCORES=(1 4 5 4 16 2 2)
+ALL_TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh link.sh dedup.sh corrupt.sh tailpack.sh compress.sh snapshot.sh utimens.sh fsync.sh journal.sh)
+ALL_TEST_SCORES=(1 4 5 4 16 2 2 3 2 1 3 3 2 4 2 2)
 MNTPOINT='./mnt'
+MOUNT_OPTS=''           # 阶段脚本挂载时附加的选项, 如--dedup
 PROJECT_NAME="newfs"
 
 LEVEL=$1
@@ -35,6 +36,14 @@ elif [[ "${LEVEL}" == "6" ]]; then
     echo "开始mount, mkdir, touch, ls, read&write, cp, umount测试"
     TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh)
     sleep 1
+elif [[ "${LEVEL}" == "7" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, link&unlink测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh link.sh)
+    sleep 1
+elif [[ "${LEVEL}" == "8" ]]; then
+    echo "开始mount, mkdir, touch, ls, read&write, cp, umount, link&unlink, 挂载选项, 快照, 时间戳及崩溃恢复测试"
+    TEST_CASES=(mount.sh mkdir.sh touch.sh ls.sh remount.sh rw.sh cp.sh link.sh dedup.sh corrupt.sh tailpack.sh compress.sh snapshot.sh utimens.sh fsync.sh journal.sh)
+    sleep 1
 else
     echo "未知测试参数"
     exit 1
@@ -96,7 +105,8 @@ function fail() {
 
 # Utils
 function mount_fuse() {
-    "$ROOT_PATH"/../build/"${PROJECT_NAME}" --device="$HOME"/ddriver "${MNTPOINT}"
+    # shellcheck disable=SC2086
+    "$ROOT_PATH"/../build/"${PROJECT_NAME}" --device="$HOME"/ddriver ${MOUNT_OPTS} "${MNTPOINT}"
 }
 
 function check_mount() {
@@ -128,6 +138,16 @@ function clean_mount() {
     done
 }
 
+function crash_fuse() {
+    # 模拟掉电: 直接杀死文件系统进程, 不走umount的写回
+    fs_pid=$(pgrep -u "$USER" "$PROJECT_NAME")
+    for PID in $fs_pid; do
+        kill -9 "$PID"
+    done
+    sleep 1
+    fusermount -u "${MNTPOINT}"
+}
+
 function mkdir_and_check () {
     DIR=$1
     if [ ! -d "$DIR" ]; then
@@ -225,7 +245,7 @@ function handle_timeout() {
 # Main
 echo "测试脚本工程根目录: $ROOT_PATH"
 
-max_execution_time=100
+max_execution_time=200
 (
     sleep $max_execution_time
     handle_timeout
@@ -0,0 +1,105 @@
+#!/bin/bash
+
+TEST_CASE="case 12 - compress"
+
+# 可压缩的内容与随机内容各一份, 大小不超过一个文件的最大数据块数
+ZIP_SRC=$(mktemp -d)
+yes "newfs compress" | head -c 4000 > "${ZIP_SRC}"/text
+head -c 3000 /dev/urandom > "${ZIP_SRC}"/random
+
+function check_zip_content () {
+    _PARAM=$1
+    for FILE in text random; do
+        if ! cmp -s "${ZIP_SRC}/${FILE}" "$_PARAM/${FILE}"; then
+            echo "$_PARAM/${FILE}的内容不同"
+            return 1
+        fi
+        if [[ "$(stat -c %s "$_PARAM/${FILE}")" != "$(stat -c %s "${ZIP_SRC}/${FILE}")" ]]; then
+            echo "$_PARAM/${FILE}的大小为$(stat -c %s "$_PARAM/${FILE}"), 应为$(stat -c %s "${ZIP_SRC}/${FILE}")"
+            return 1
+        fi
+    done
+    return 0
+}
+
+function used_bytes () {
+    echo $(( $(stat -c %b "$1") * $(stat -c %B "$1") ))
+}
+
+function check_zip_write () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    for FILE in text random; do
+        touch_and_check "$_PARAM/${FILE}"
+        cp "${ZIP_SRC}/${FILE}" "$_PARAM/${FILE}"
+    done
+    if ! MSG=$(check_zip_content "$_PARAM"); then
+        fail "$_TEST_CASE: 以--compress挂载后写入: ${MSG}"
+        return 1
+    fi
+    return 0
+}
+
+# 可压缩的文件占用空间应小于原大小, 随机内容压缩不了, 原样保存
+function check_zip_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! MSG=$(check_zip_content "$_PARAM"); then
+        fail "$_TEST_CASE: remount后${MSG}"
+        return 1
+    fi
+    if (( $(used_bytes "$_PARAM"/text) >= $(stat -c %s "$_PARAM"/text) )); then
+        fail "$_TEST_CASE: $_PARAM/text占用$(used_bytes "$_PARAM"/text)字节, 没有压缩"
+        return 1
+    fi
+    return 0
+}
+
+# 改写压缩文件的中间部分, 要先解压, 再次卸载时重新压缩
+function check_zip_rewrite () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    for FILE in text random; do
+        printf "rewritten" | dd of="${ZIP_SRC}/${FILE}" bs=1 seek=1500 conv=notrunc status=none
+        printf "rewritten" | dd of="$_PARAM/${FILE}" bs=1 seek=1500 conv=notrunc status=none
+    done
+    clean_mount
+    sleep 1
+    try_mount_or_fail
+    if ! MSG=$(check_zip_content "$_PARAM"); then
+        fail "$_TEST_CASE: 改写并remount后${MSG}"
+        return 1
+    fi
+    if (( $(used_bytes "$_PARAM"/text) >= $(stat -c %s "$_PARAM"/text) )); then
+        fail "$_TEST_CASE: 改写并remount后$_PARAM/text没有重新压缩"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+MOUNT_OPTS="--compress"
+
+try_mount_or_fail
+
+TEST_CASE="case 12.1 - write files with --compress"
+core_tester echo "${MNTPOINT}" check_zip_write "$TEST_CASE"
+
+clean_mount
+sleep 1
+try_mount_or_fail
+
+TEST_CASE="case 12.2 - remount with --compress"
+core_tester echo "${MNTPOINT}" check_zip_remount "$TEST_CASE"
+
+TEST_CASE="case 12.3 - rewrite compressed files"
+core_tester echo "${MNTPOINT}" check_zip_rewrite "$TEST_CASE"
+
+clean_mount
+clean_ddriver
+MOUNT_OPTS=""
+rm -rf "${ZIP_SRC}"
@@ -0,0 +1,79 @@
+#!/bin/bash
+
+TEST_CASE="case 10 - corrupted inode"
+
+# 文件大小选一个不会与其他inode记录相同的值, 卸载后据此在索引节点区找到它的记录
+CORRUPT_SIZE=3333
+
+# 改写磁盘上file0的inode记录中的size, 校验和随之不符
+function corrupt_inode () {
+    python3 - "$HOME"/ddriver "${CORRUPT_SIZE}" <<'PYEOF'
+import struct, sys
+dev, size = sys.argv[1], int(sys.argv[2])
+REC = 256                                   # struct newfs_inode_d2
+with open(dev, "r+b") as f:
+    sb = f.read(64)
+    inode_offset, sz_blks = struct.unpack_from("<i", sb, 28)[0], struct.unpack_from("<i", sb, 32)[0]
+    f.seek(inode_offset)
+    itab = f.read(sz_blks * 16)
+    for ofs in range(0, len(itab), REC):
+        if struct.unpack_from("<I", itab, ofs + 4)[0] == size:
+            f.seek(inode_offset + ofs + 4)
+            f.write(struct.pack("<I", size + 1))
+            sys.exit(0)
+sys.exit(1)
+PYEOF
+}
+
+# 期望以EIO失败, 而不是成功或让文件系统崩溃
+function expect_eio () {
+    python3 - "$1" <<'PYEOF'
+import errno, os, sys
+try:
+    os.stat(sys.argv[1])
+except OSError as e:
+    sys.exit(0 if e.errno == errno.EIO else 1)
+sys.exit(1)
+PYEOF
+}
+
+function check_corrupt () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! expect_eio "$_PARAM"/file0; then
+        fail "$_TEST_CASE: stat校验和不符的$_PARAM/file0没有返回EIO"
+        return 1
+    fi
+    if ! check_mount; then
+        fail "$_TEST_CASE: 读到损坏的inode后$PROJECT_NAME文件系统退出"
+        return 1
+    fi
+    if [[ "$(cat "$_PARAM"/file1)" != "intact" ]]; then
+        fail "$_TEST_CASE: 其他文件$_PARAM/file1受到影响"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+mkdir_and_check "${MNTPOINT}"/dir0
+head -c ${CORRUPT_SIZE} /dev/zero > "${MNTPOINT}"/dir0/file0
+echo "intact" > "${MNTPOINT}"/dir0/file1
+
+clean_mount
+sleep 1
+if ! corrupt_inode; then
+    fail "$TEST_CASE: 在索引节点区没有找到大小为${CORRUPT_SIZE}的inode记录"
+fi
+try_mount_or_fail
+
+TEST_CASE="case 10.1 - stat a file whose inode checksum mismatches"
+core_tester echo "${MNTPOINT}"/dir0 check_corrupt "$TEST_CASE"
+
+clean_mount
+clean_ddriver
@@ -0,0 +1,69 @@
+#!/bin/bash
+
+TEST_CASE="case 9 - dedup"
+
+DEDUP_SRC=$(mktemp)
+head -c 16384 /dev/urandom > "${DEDUP_SRC}"
+
+function free_blocks () {
+    stat -f -c %f "${MNTPOINT}"
+}
+
+# 同样的内容写入两个文件, 第二份应全部与第一份共享数据块
+function check_dedup_write () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    touch_and_check "$_PARAM"/file0
+    touch_and_check "$_PARAM"/file1
+    FREE0=$(free_blocks)
+    cp "${DEDUP_SRC}" "$_PARAM"/file0
+    FREE1=$(free_blocks)
+    cp "${DEDUP_SRC}" "$_PARAM"/file1
+    FREE2=$(free_blocks)
+    if ! cmp -s "${DEDUP_SRC}" "$_PARAM"/file0 || ! cmp -s "${DEDUP_SRC}" "$_PARAM"/file1; then
+        fail "$_TEST_CASE: 以--dedup挂载后写入的内容不同"
+        return 1
+    fi
+    if (( FREE1 >= FREE0 )) || (( FREE2 != FREE1 )); then
+        fail "$_TEST_CASE: 空闲块数依次为$FREE0, $FREE1, $FREE2, 第二份相同的内容没有去重"
+        return 1
+    fi
+    return 0
+}
+
+function check_dedup_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! cmp -s "${DEDUP_SRC}" "$_PARAM"/file0 || ! cmp -s "${DEDUP_SRC}" "$_PARAM"/file1; then
+        fail "$_TEST_CASE: remount后读出的内容不同"
+        return 1
+    fi
+    if [[ "$(free_blocks)" != "${FREE2}" ]]; then
+        fail "$_TEST_CASE: remount后空闲块数为$(free_blocks), 卸载前为${FREE2}"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+MOUNT_OPTS="--dedup"
+
+try_mount_or_fail
+
+TEST_CASE="case 9.1 - write identical data with --dedup"
+core_tester echo "${MNTPOINT}" check_dedup_write "$TEST_CASE"
+
+clean_mount
+sleep 1
+try_mount_or_fail
+
+TEST_CASE="case 9.2 - remount with --dedup"
+core_tester echo "${MNTPOINT}" check_dedup_remount "$TEST_CASE"
+
+clean_mount
+clean_ddriver
+MOUNT_OPTS=""
+rm -f "${DEDUP_SRC}"
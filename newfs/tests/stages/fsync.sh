@@ -0,0 +1,65 @@
+#!/bin/bash
+
+TEST_CASE="case 15 - fsync"
+
+FSYNC_SRC=$(mktemp -d)
+
+# 文件在干净卸载前建好, 崩溃只考察之后fsync/fdatasync写入的数据
+function prepare_fsync_files () {
+    _PARAM=$1
+    mkdir_and_check "$_PARAM"/dir0
+    touch_and_check "$_PARAM"/dir0/file0
+    touch_and_check "$_PARAM"/dir0/file1
+    clean_mount
+    sleep 1
+    try_mount_or_fail
+}
+
+function check_fsync_crash () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    head -c "${FSYNC_SIZE}" /dev/urandom > "${FSYNC_SRC}"/file0
+    head -c "${FSYNC_SIZE}" /dev/urandom > "${FSYNC_SRC}"/file1
+    dd if="${FSYNC_SRC}"/file0 of="$_PARAM"/dir0/file0 conv=fsync status=none
+    dd if="${FSYNC_SRC}"/file1 of="$_PARAM"/dir0/file1 conv=fdatasync status=none
+    crash_fuse
+    try_mount_or_fail
+    for FILE in file0 file1; do
+        if ! cmp -s "${FSYNC_SRC}/${FILE}" "$_PARAM/dir0/${FILE}"; then
+            fail "$_TEST_CASE: 进程被杀死并重新挂载后, 已同步的$_PARAM/dir0/${FILE}内容不同"
+            return 1
+        fi
+        if [[ "$(stat -c %s "$_PARAM/dir0/${FILE}")" != "${FSYNC_SIZE}" ]]; then
+            fail "$_TEST_CASE: 进程被杀死并重新挂载后, 已同步的$_PARAM/dir0/${FILE}大小为$(stat -c %s "$_PARAM/dir0/${FILE}")"
+            return 1
+        fi
+    done
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+prepare_fsync_files "${MNTPOINT}"
+
+TEST_CASE="case 15.1 - kill after fsync with the journal"
+FSYNC_SIZE=3000
+core_tester echo "${MNTPOINT}" check_fsync_crash "$TEST_CASE"
+
+clean_mount
+clean_ddriver
+MOUNT_OPTS="--blksz=65536"              # 大块时日志区不足最小块数, 不启用日志
+
+try_mount_or_fail
+prepare_fsync_files "${MNTPOINT}"
+
+TEST_CASE="case 15.2 - kill after fsync without the journal"
+FSYNC_SIZE=100000
+core_tester echo "${MNTPOINT}" check_fsync_crash "$TEST_CASE"
+
+clean_mount
+clean_ddriver
+MOUNT_OPTS=""
+rm -rf "${FSYNC_SRC}"
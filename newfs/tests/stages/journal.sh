@@ -0,0 +1,89 @@
+#!/bin/bash
+
+TEST_CASE="case 16 - journal replay"
+
+# 尾部小于一个碎片块的小文件, 打包后碎片块头部和碎片链表头都要经日志提交
+REPLAY_SIZES=(100 700 1300 2200)
+REPLAY_SRC=$(mktemp -d)
+for SIZE in "${REPLAY_SIZES[@]}"; do
+    head -c "${SIZE}" /dev/urandom > "${REPLAY_SRC}/file${SIZE}"
+done
+
+function free_blocks () {
+    stat -f -c %f "${MNTPOINT}"
+}
+
+function check_replay_content () {
+    _PARAM=$1
+    for SIZE in "${REPLAY_SIZES[@]}"; do
+        if ! cmp -s "${REPLAY_SRC}/file${SIZE}" "$_PARAM/file${SIZE}"; then
+            echo "$_PARAM/file${SIZE}的内容不同"
+            return 1
+        fi
+    done
+    return 0
+}
+
+# fsync提交事务后杀死进程, 重新挂载时重放日志
+function check_replay_crash () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    mkdir_and_check "$_PARAM"/dir0
+    for SIZE in "${REPLAY_SIZES[@]}"; do
+        dd if="${REPLAY_SRC}/file${SIZE}" of="$_PARAM/dir0/file${SIZE}" conv=fsync status=none
+    done
+    crash_fuse
+    try_mount_or_fail
+    if ! MSG=$(check_replay_content "$_PARAM"/dir0); then
+        fail "$_TEST_CASE: 进程被杀死并重放日志后${MSG}"
+        return 1
+    fi
+    return 0
+}
+
+# 重放后的碎片链表要能继续分配, 干净卸载再挂载后新旧文件都完好, 空闲块数不变
+function check_replay_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    mkdir_and_check "$_PARAM"/dir1
+    for SIZE in "${REPLAY_SIZES[@]}"; do
+        cp "${REPLAY_SRC}/file${SIZE}" "$_PARAM/dir1/file${SIZE}"
+    done
+    clean_mount
+    sleep 1
+    try_mount_or_fail
+    FREE0=$(free_blocks)
+    for DIR in dir0 dir1; do
+        if ! MSG=$(check_replay_content "$_PARAM/${DIR}"); then
+            fail "$_TEST_CASE: 重放后继续写入并remount, ${MSG}"
+            return 1
+        fi
+    done
+    clean_mount
+    sleep 1
+    try_mount_or_fail
+    if [[ "$(free_blocks)" != "${FREE0}" ]]; then
+        fail "$_TEST_CASE: 再次remount后空闲块数为$(free_blocks), 之前为${FREE0}"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+MOUNT_OPTS="--tailpack"
+
+try_mount_or_fail
+
+TEST_CASE="case 16.1 - replay packed tails after a kill"
+core_tester echo "${MNTPOINT}" check_replay_crash "$TEST_CASE"
+
+TEST_CASE="case 16.2 - write and remount after replay"
+core_tester echo "${MNTPOINT}" check_replay_remount "$TEST_CASE"
+
+clean_mount
+clean_ddriver
+MOUNT_OPTS=""
+rm -rf "${REPLAY_SRC}"
@@ -0,0 +1,95 @@
+#!/bin/bash
+
+TEST_CASE="case 8 - link/unlink"
+
+GOLDEN="hard link golden"
+NFILES=150
+
+function check_link () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! ln "${MNTPOINT}"/file0 "$_PARAM"; then
+        fail "$_TEST_CASE: 为${MNTPOINT}/file0建立硬链接$_PARAM失败"
+        return 1
+    fi
+    if [[ "$(stat -c %h "${MNTPOINT}"/file0)" != "2" ]] || [[ "$(stat -c %h "$_PARAM")" != "2" ]]; then
+        fail "$_TEST_CASE: 建立硬链接后链接数不为2"
+        return 1
+    fi
+    if [[ "$(cat "$_PARAM")" != "${GOLDEN}" ]]; then
+        fail "$_TEST_CASE: 经硬链接$_PARAM读出的内容不同, 正确的内容为: $GOLDEN"
+        return 1
+    fi
+    return 0
+}
+
+function check_unlink () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! rm "${MNTPOINT}"/file0; then
+        fail "$_TEST_CASE: 删除${MNTPOINT}/file0失败"
+        return 1
+    fi
+    if [ -e "${MNTPOINT}"/file0 ]; then
+        fail "$_TEST_CASE: ${MNTPOINT}/file0删除后仍然存在"
+        return 1
+    fi
+    if [[ "$(stat -c %h "$_PARAM")" != "1" ]] || [[ "$(cat "$_PARAM")" != "${GOLDEN}" ]]; then
+        fail "$_TEST_CASE: 删除一个名字后$_PARAM的链接数或内容不对"
+        return 1
+    fi
+    return 0
+}
+
+# 用小缓冲区逐批getdents，每批读完立即删除，内核会按上次的offset续读
+function check_readdir_unlink () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    mkdir_and_check "$_PARAM"
+    for i in $(seq 1 ${NFILES}); do
+        touch "$_PARAM"/file"$i"
+    done
+    python3 - "$_PARAM" <<'EOF'
+import ctypes, os, platform, struct, sys
+SYS_getdents64 = {"x86_64": 217, "aarch64": 61}[platform.machine()]
+libc = ctypes.CDLL(None, use_errno=True)
+path = sys.argv[1]
+fd = os.open(path, os.O_RDONLY | os.O_DIRECTORY)
+buf = ctypes.create_string_buffer(512)
+while True:
+    n = libc.syscall(SYS_getdents64, fd, buf, len(buf))
+    if n <= 0:
+        break
+    pos = 0
+    while pos < n:
+        reclen = struct.unpack_from("H", buf.raw, pos + 16)[0]
+        name = buf.raw[pos + 19:pos + reclen].split(b"\0", 1)[0].decode()
+        if name not in (".", ".."):
+            os.unlink(os.path.join(path, name))
+        pos += reclen
+os.close(fd)
+EOF
+    LEFT=$(ls "$_PARAM" | wc -l)
+    if (( LEFT != 0 )); then
+        fail "$_TEST_CASE: 边列目录边删除后$_PARAM中还剩${LEFT}个文件, 续读时跳过了目录项"
+        return 1
+    fi
+    return 0
+}
+
+try_mount_or_fail
+
+touch_and_check "${MNTPOINT}"/file0
+echo "${GOLDEN}" > "${MNTPOINT}"/file0
+
+TEST_CASE="case 8.1 - link ${MNTPOINT}/link0"
+core_tester echo "${MNTPOINT}"/link0 check_link "$TEST_CASE"
+
+TEST_CASE="case 8.2 - unlink ${MNTPOINT}/file0"
+core_tester echo "${MNTPOINT}"/link0 check_unlink "$TEST_CASE"
+
+TEST_CASE="case 8.3 - readdir while unlinking in ${MNTPOINT}/dir0"
+core_tester echo "${MNTPOINT}"/dir0 check_readdir_unlink "$TEST_CASE"
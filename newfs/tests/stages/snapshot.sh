@@ -0,0 +1,85 @@
+#!/bin/bash
+
+TEST_CASE="case 13 - snapshot"
+
+SNAP_DIR="${MNTPOINT}"/.snapshots
+SNAP_SRC=$(mktemp -d)
+head -c 3000 /dev/urandom > "${SNAP_SRC}"/before
+head -c 2000 /dev/urandom > "${SNAP_SRC}"/after
+
+# 快照保留创建时的内容, 活动文件系统是覆盖后的内容
+function check_snap_content () {
+    _PARAM=$1
+    if ! cmp -s "${SNAP_SRC}"/before "${SNAP_DIR}"/s1/dir0/file0; then
+        echo "快照中的dir0/file0不是创建快照时的内容"
+        return 1
+    fi
+    if ! cmp -s "${SNAP_SRC}"/after "$_PARAM"/dir0/file0; then
+        echo "$_PARAM/dir0/file0不是覆盖后的内容"
+        return 1
+    fi
+    if [ -e "${SNAP_DIR}"/s1/dir0/file1 ] || [ ! -f "$_PARAM"/dir0/file1 ]; then
+        echo "快照之后新建的dir0/file1只应出现在活动文件系统中"
+        return 1
+    fi
+    return 0
+}
+
+function check_snap_create () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    mkdir_and_check "$_PARAM"/dir0
+    touch_and_check "$_PARAM"/dir0/file0
+    cp "${SNAP_SRC}"/before "$_PARAM"/dir0/file0
+    if ! mkdir "${SNAP_DIR}"/s1; then
+        fail "$_TEST_CASE: 创建快照${SNAP_DIR}/s1失败"
+        return 1
+    fi
+    cp "${SNAP_SRC}"/after "$_PARAM"/dir0/file0
+    touch_and_check "$_PARAM"/dir0/file1
+    if ! MSG=$(check_snap_content "$_PARAM"); then
+        fail "$_TEST_CASE: ${MSG}"
+        return 1
+    fi
+    return 0
+}
+
+# 快照只读, 写入应失败且不影响内容
+function check_snap_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! MSG=$(check_snap_content "$_PARAM"); then
+        fail "$_TEST_CASE: remount后${MSG}"
+        return 1
+    fi
+    if (echo "overwrite" > "${SNAP_DIR}"/s1/dir0/file0) 2>/dev/null; then
+        fail "$_TEST_CASE: 写入只读的快照成功"
+        return 1
+    fi
+    if ! cmp -s "${SNAP_SRC}"/before "${SNAP_DIR}"/s1/dir0/file0; then
+        fail "$_TEST_CASE: 写入快照失败后快照内容被改变"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+TEST_CASE="case 13.1 - overwrite a file after taking a snapshot"
+core_tester echo "${MNTPOINT}" check_snap_create "$TEST_CASE"
+
+clean_mount
+sleep 1
+try_mount_or_fail
+
+TEST_CASE="case 13.2 - remount with a snapshot"
+core_tester echo "${MNTPOINT}" check_snap_remount "$TEST_CASE"
+
+clean_mount
+clean_ddriver
+rm -rf "${SNAP_SRC}"
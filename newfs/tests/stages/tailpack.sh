@@ -0,0 +1,105 @@
+#!/bin/bash
+
+TEST_CASE="case 11 - tailpack"
+
+# 尾部不满一块的小文件, 尾部须小于一个碎片块才会被打包
+TAIL_SIZES=(100 500 1100 3000)
+TAIL_SRC=$(mktemp -d)
+for SIZE in "${TAIL_SIZES[@]}"; do
+    head -c "${SIZE}" /dev/urandom > "${TAIL_SRC}/file${SIZE}"
+done
+
+function check_tail_content () {
+    _PARAM=$1
+    for SIZE in "${TAIL_SIZES[@]}"; do
+        if ! cmp -s "${TAIL_SRC}/file${SIZE}" "$_PARAM/file${SIZE}"; then
+            echo "$_PARAM/file${SIZE}的内容不同"
+            return 1
+        fi
+        if [[ "$(stat -c %s "$_PARAM/file${SIZE}")" != "${SIZE}" ]]; then
+            echo "$_PARAM/file${SIZE}的大小为$(stat -c %s "$_PARAM/file${SIZE}"), 应为${SIZE}"
+            return 1
+        fi
+    done
+    return 0
+}
+
+function check_tail_write () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    for SIZE in "${TAIL_SIZES[@]}"; do
+        touch_and_check "$_PARAM/file${SIZE}"
+        cp "${TAIL_SRC}/file${SIZE}" "$_PARAM/file${SIZE}"
+    done
+    if ! MSG=$(check_tail_content "$_PARAM"); then
+        fail "$_TEST_CASE: 以--tailpack挂载后写入: ${MSG}"
+        return 1
+    fi
+    return 0
+}
+
+# 打包后尾部只占碎片单元, 占用空间应小于按整块向上取整的大小
+function check_tail_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! MSG=$(check_tail_content "$_PARAM"); then
+        fail "$_TEST_CASE: remount后${MSG}"
+        return 1
+    fi
+    for SIZE in "${TAIL_SIZES[@]}"; do
+        BLKSZ=$(stat -c %o "$_PARAM/file${SIZE}")
+        USED=$(( $(stat -c %b "$_PARAM/file${SIZE}") * $(stat -c %B "$_PARAM/file${SIZE}") ))
+        FULL=$(( (SIZE + BLKSZ - 1) / BLKSZ * BLKSZ ))
+        if (( USED >= FULL )); then
+            fail "$_TEST_CASE: $_PARAM/file${SIZE}占用${USED}字节, 尾部没有打包"
+            return 1
+        fi
+    done
+    return 0
+}
+
+# 追加写打包文件, 尾部要先放回数据块, 再次卸载时重新打包
+function check_tail_append () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    for SIZE in "${TAIL_SIZES[@]}"; do
+        echo "append" | tee -a "${TAIL_SRC}/file${SIZE}" >> "$_PARAM/file${SIZE}"
+    done
+    clean_mount
+    sleep 1
+    try_mount_or_fail
+    for SIZE in "${TAIL_SIZES[@]}"; do
+        if ! cmp -s "${TAIL_SRC}/file${SIZE}" "$_PARAM/file${SIZE}"; then
+            fail "$_TEST_CASE: 追加写并remount后$_PARAM/file${SIZE}的内容不同"
+            return 1
+        fi
+    done
+    return 0
+}
+
+clean_mount
+clean_ddriver
+MOUNT_OPTS="--tailpack"
+
+try_mount_or_fail
+
+TEST_CASE="case 11.1 - write small files with --tailpack"
+core_tester echo "${MNTPOINT}" check_tail_write "$TEST_CASE"
+
+clean_mount
+sleep 1
+try_mount_or_fail
+
+TEST_CASE="case 11.2 - remount with --tailpack"
+core_tester echo "${MNTPOINT}" check_tail_remount "$TEST_CASE"
+
+TEST_CASE="case 11.3 - append to packed tails"
+core_tester echo "${MNTPOINT}" check_tail_append "$TEST_CASE"
+
+clean_mount
+clean_ddriver
+MOUNT_OPTS=""
+rm -rf "${TAIL_SRC}"
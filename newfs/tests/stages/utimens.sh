@@ -0,0 +1,126 @@
+#!/bin/bash
+
+TEST_CASE="case 14 - timestamps"
+
+# 带纳秒的时间戳, 与本地文件系统上同样touch的参考文件比较
+ATIME_STAMP="2001-02-03 04:05:06.123456789"
+MTIME_STAMP="2002-03-04 05:06:07.987654321"
+TIME_REF=$(mktemp)
+touch -a -d "${ATIME_STAMP}" "${TIME_REF}"
+touch -m -d "${MTIME_STAMP}" "${TIME_REF}"
+
+function check_times () {
+    FILE=$1
+    if [[ "$(stat -c '%x %y' "$FILE")" != "$(stat -c '%x %y' "${TIME_REF}")" ]]; then
+        echo "$FILE的atime/mtime为$(stat -c '%x, %y' "$FILE"), 应为$(stat -c '%x, %y' "${TIME_REF}")"
+        return 1
+    fi
+    return 0
+}
+
+function check_utimens () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    mkdir_and_check "$_PARAM"/dir0
+    touch_and_check "$_PARAM"/dir0/file0
+    echo "timestamps" > "$_PARAM"/dir0/file0
+    touch -a -d "${ATIME_STAMP}" "$_PARAM"/dir0/file0
+    touch -m -d "${MTIME_STAMP}" "$_PARAM"/dir0/file0
+    if ! MSG=$(check_times "$_PARAM"/dir0/file0); then
+        fail "$_TEST_CASE: touch -d后${MSG}"
+        return 1
+    fi
+    return 0
+}
+
+function check_utimens_remount () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    if ! MSG=$(check_times "$_PARAM"/dir0/file0); then
+        fail "$_TEST_CASE: remount后${MSG}"
+        return 1
+    fi
+    return 0
+}
+
+# --noatime挂载时读文件不改atime
+function check_noatime () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    cat "$_PARAM"/dir0/file0 > /dev/null
+    if ! MSG=$(check_times "$_PARAM"/dir0/file0); then
+        fail "$_TEST_CASE: 以--noatime挂载读文件后${MSG}"
+        return 1
+    fi
+    clean_mount
+    sleep 1
+    try_mount_or_fail
+    if ! MSG=$(check_times "$_PARAM"/dir0/file0); then
+        fail "$_TEST_CASE: 以--noatime挂载读文件并remount后${MSG}"
+        return 1
+    fi
+    return 0
+}
+
+# 默认relatime下atime早于mtime时读文件要更新atime, 写文件更新mtime, 并且都要落盘
+function check_relatime () {
+    _PARAM=$1
+    _TEST_CASE=$2
+
+    touch_and_check "$_PARAM"/dir0/file1
+    cat "$_PARAM"/dir0/file0 > /dev/null
+    echo "modified" >> "$_PARAM"/dir0/file1
+    ATIME=$(stat -c %X "$_PARAM"/dir0/file0)
+    MTIME=$(stat -c %Y "$_PARAM"/dir0/file1)
+    clean_mount
+    sleep 1
+    try_mount_or_fail
+    if (( ATIME <= $(stat -c %Y "$_PARAM"/dir0/file0) )); then
+        fail "$_TEST_CASE: 读文件后$_PARAM/dir0/file0的atime没有更新"
+        return 1
+    fi
+    if [[ "$(stat -c %X "$_PARAM"/dir0/file0)" != "${ATIME}" ]] ||
+       [[ "$(stat -c %Y "$_PARAM"/dir0/file1)" != "${MTIME}" ]]; then
+        fail "$_TEST_CASE: remount后atime/mtime与卸载前不同"
+        return 1
+    fi
+    return 0
+}
+
+clean_mount
+clean_ddriver
+
+try_mount_or_fail
+
+TEST_CASE="case 14.1 - set atime and mtime with touch -d"
+core_tester echo "${MNTPOINT}" check_utimens "$TEST_CASE"
+
+clean_mount
+sleep 1
+try_mount_or_fail
+
+TEST_CASE="case 14.2 - remount after touch -d"
+core_tester echo "${MNTPOINT}" check_utimens_remount "$TEST_CASE"
+
+clean_mount
+sleep 1
+MOUNT_OPTS="--noatime"
+try_mount_or_fail
+
+TEST_CASE="case 14.3 - read with --noatime"
+core_tester echo "${MNTPOINT}" check_noatime "$TEST_CASE"
+
+clean_mount
+sleep 1
+MOUNT_OPTS=""
+try_mount_or_fail
+
+TEST_CASE="case 14.4 - read and write with relatime"
+core_tester echo "${MNTPOINT}" check_relatime "$TEST_CASE"
+
+clean_mount
+clean_ddriver
+rm -f "${TIME_REF}"
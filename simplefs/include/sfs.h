@@ -23,7 +23,7 @@
 * SECTION: sfs_utils.c
 *******************************************************************************/
 char* 			   sfs_get_fname(const char* path);
-int 			   sfs_calc_lvl(const char * path);
+const char* 		   sfs_path_next(const char* path, int* len);
 int 			   sfs_driver_read(int offset, uint8_t *out_content, int size);
 int 			   sfs_driver_write(int offset, uint8_t *in_content, int size);
 
@@ -37,6 +37,7 @@ struct sfs_inode*  sfs_alloc_inode(struct sfs_dentry * dentry);
 int 			   sfs_sync_inode(struct sfs_inode * inode);
 int 			   sfs_drop_inode(struct sfs_inode * inode);
 struct sfs_inode*  sfs_read_inode(struct sfs_dentry * dentry, int ino);
+int 			   sfs_load_data(struct sfs_inode * inode, int offset, int size, boolean is_overwrite);
 struct sfs_dentry* sfs_get_dentry(struct sfs_inode * inode, int dir);
 
 struct sfs_dentry* sfs_lookup(const char * path, boolean * is_find, boolean* is_root);
@@ -64,6 +65,7 @@ int 			   sfs_readlink(const char *, char *, size_t);
 			
 int   			   sfs_open(const char *, struct fuse_file_info *);
 int   			   sfs_opendir(const char *, struct fuse_file_info *);
+int   			   sfs_releasedir(const char *, struct fuse_file_info *);
 int   			   sfs_access(const char *, int);
 /******************************************************************************
 * SECTION: sfs_debug.c
@@ -64,6 +64,7 @@ typedef enum sfs_file_type {
                                         SFS_INODE_PER_FILE + SFS_DATA_PER_FILE)))
 #define SFS_DATA_OFS(ino)               (SFS_INO_OFS(ino) + SFS_BLKS_SZ(SFS_INODE_PER_FILE))
 
+#define SFS_BLK_RESIDENT(pinode, blk)   ((pinode)->data_resident & (0x1U << (blk)))
 #define SFS_IS_DIR(pinode)              (pinode->dentry->ftype == SFS_DIR)
 #define SFS_IS_REG(pinode)              (pinode->dentry->ftype == SFS_REG_FILE)
 #define SFS_IS_SYM_LINK(pinode)         (pinode->dentry->ftype == SFS_SYM_LINK)
@@ -88,6 +89,7 @@ struct sfs_inode
     struct sfs_dentry* dentry;                        /* 指向该inode的dentry */
     struct sfs_dentry* dentrys;                       /* 所有目录项 */
     uint8_t*           data;           
+    uint32_t           data_resident;                 /* data中已从磁盘读入的块位图 */
 };  
 
 struct sfs_dentry
@@ -116,10 +118,19 @@ struct sfs_super
     int                data_offset;
 
     boolean            is_mounted;
+    uint32_t           dir_gen;                       /* 删除目录项时递增，旧的readdir游标随之失效 */
 
     struct sfs_dentry* root_dentry;
 };
 
+struct sfs_dir_cursor
+{
+    struct sfs_dentry* dir;                           /* opendir时解析出的目录 */
+    struct sfs_dentry* next;                          /* 下一个要填充的目录项 */
+    off_t              pos;                           /* next在目录项链表中的序号 */
+    uint32_t           gen;                           /* 建立游标时的dir_gen */
+};
+
 static inline struct sfs_dentry* new_dentry(char * fname, SFS_FILE_TYPE ftype) {
     struct sfs_dentry * dentry = (struct sfs_dentry *)malloc(sizeof(struct sfs_dentry));
     memset(dentry, 0, sizeof(struct sfs_dentry));
@@ -38,6 +38,7 @@ static struct fuse_operations operations = {
 
 	.open = sfs_open,							
 	.opendir = sfs_opendir,
+	.releasedir = sfs_releasedir,
 	.access = sfs_access
 };
 /******************************************************************************
@@ -147,26 +148,40 @@ int sfs_getattr(const char* path, struct stat * sfs_stat) {
  * off: 下一次offset从哪里开始，这里可以理解为第几个dentry
  * 
  * @param offset 
- * @param fi 
+ * @param fi opendir在fi->fh中保存的游标，为空或已失效时重新解析路径
  * @return int 
  */
 int sfs_readdir(const char * path, void * buf, fuse_fill_dir_t filler, off_t offset,
 			    struct fuse_file_info * fi) {
-    boolean	is_find, is_root;
-	int		cur_dir = offset;
+	struct sfs_dir_cursor  tmp;
+	struct sfs_dir_cursor* cursor = fi != NULL ? (struct sfs_dir_cursor*)(uintptr_t)fi->fh : NULL;
+	boolean	is_find, is_root;
 
-	struct sfs_dentry* dentry = sfs_lookup(path, &is_find, &is_root);
-	struct sfs_dentry* sub_dentry;
-	struct sfs_inode* inode;
-	if (is_find) {
-		inode = dentry->inode;
-		sub_dentry = sfs_get_dentry(inode, cur_dir);
-		if (sub_dentry) {
-			filler(buf, sub_dentry->fname, NULL, ++offset);
+	if (cursor == NULL) {
+		cursor = &tmp;
+		cursor->gen = sfs_super.dir_gen + 1;
+	}
+	if (cursor->gen != sfs_super.dir_gen) {			  /* 期间有目录项被删除，重新解析 */
+		cursor->dir = sfs_lookup(path, &is_find, &is_root);
+		if (!is_find) {
+			return -SFS_ERROR_NOTFOUND;
 		}
-		return SFS_ERROR_NONE;
+		cursor->next = sfs_get_dentry(cursor->dir->inode, offset);
+		cursor->pos  = offset;
+		cursor->gen  = sfs_super.dir_gen;
 	}
-	return -SFS_ERROR_NOTFOUND;
+	else if (offset != cursor->pos) {				  /* rewinddir/seekdir */
+		cursor->next = sfs_get_dentry(cursor->dir->inode, offset);
+		cursor->pos  = offset;
+	}
+	while (cursor->next != NULL) {					  /* 填满buf为止，下次从游标处继续 */
+		if (filler(buf, cursor->next->fname, NULL, cursor->pos + 1) != 0) {
+			break;
+		}
+		cursor->next = cursor->next->brother;
+		cursor->pos++;
+	}
+	return SFS_ERROR_NONE;
 }
 /**
  * @brief 
@@ -235,6 +250,9 @@ int sfs_write(const char* path, const char* buf, size_t size, off_t offset,
 		return -SFS_ERROR_SEEK;
 	}
 
+	if (sfs_load_data(inode, offset, size, TRUE) != SFS_ERROR_NONE) {
+		return -SFS_ERROR_IO;
+	}
 	memcpy(inode->data + offset, buf, size);
 	inode->size = offset + size > inode->size ? offset + size : inode->size;
 	
@@ -270,6 +288,9 @@ int sfs_read(const char* path, char* buf, size_t size, off_t offset,
 		return -SFS_ERROR_SEEK;
 	}
 
+	if (sfs_load_data(inode, offset, size, FALSE) != SFS_ERROR_NONE) {
+		return -SFS_ERROR_IO;
+	}
 	memcpy(buf, inode->data + offset, size);
 
 	return size;			   
@@ -422,6 +443,34 @@ int sfs_open(const char* path, struct fuse_file_info* fi) {
  * @return int 
  */
 int sfs_opendir(const char* path, struct fuse_file_info* fi) {
+	boolean	is_find, is_root;
+	struct sfs_dentry*     dentry = sfs_lookup(path, &is_find, &is_root);
+	struct sfs_dir_cursor* cursor;
+
+	if (is_find == FALSE) {
+		return -SFS_ERROR_NOTFOUND;
+	}
+	cursor = (struct sfs_dir_cursor*)malloc(sizeof(struct sfs_dir_cursor));
+	if (cursor == NULL) {
+		return -SFS_ERROR_NOSPACE;
+	}
+	cursor->dir  = dentry;
+	cursor->next = dentry->inode->dentrys;
+	cursor->pos  = 0;
+	cursor->gen  = sfs_super.dir_gen;
+	fi->fh = (uint64_t)(uintptr_t)cursor;
+	return SFS_ERROR_NONE;
+}
+/**
+ * @brief 释放opendir建立的游标
+ * 
+ * @param path 
+ * @param fi 
+ * @return int 
+ */
+int sfs_releasedir(const char* path, struct fuse_file_info* fi) {
+	free((struct sfs_dir_cursor*)(uintptr_t)fi->fh);
+	fi->fh = 0;
 	return SFS_ERROR_NONE;
 }
 /**
@@ -15,27 +15,24 @@ char* sfs_get_fname(const char* path) {
     return q;
 }
 /**
- * @brief 计算路径的层级
- * exm: /av/c/d/f
- * -> lvl = 4
- * @param path 
- * @return int 
+ * @brief 取路径中的下一个分量，跳过连续的'/'，不修改路径也不分配内存
+ * exm: /av//c/ -> "av"(2), "c"(1), NULL
+ * @param path 上一个分量之后的位置，首次调用传入整条路径
+ * @param len 返回分量长度
+ * @return const char* 分量起始位置，没有更多分量返回NULL
  */
-int sfs_calc_lvl(const char * path) {
-    // char* path_cpy = (char *)malloc(strlen(path));
-    // strcpy(path_cpy, path);
-    char* str = path;
-    int   lvl = 0;
-    if (strcmp(path, "/") == 0) {
-        return lvl;
-    }
-    while (*str != NULL) {
-        if (*str == '/') {
-            lvl++;
-        }
-        str++;
+const char* sfs_path_next(const char* path, int* len) {
+    const char* end;
+
+    while (*path == '/') {
+        path++;
+    }
+    if (*path == '\0') {
+        return NULL;
     }
-    return lvl;
+    for (end = path; *end != '\0' && *end != '/'; end++);
+    *len = end - path;
+    return path;
 }
 /**
  * @brief 驱动读
@@ -143,6 +140,7 @@ int sfs_drop_dentry(struct sfs_inode * inode, struct sfs_dentry * dentry) {
         return -SFS_ERROR_NOTFOUND;
     }
     inode->dir_cnt--;
+    sfs_super.dir_gen++;                              /* dentry即将被释放，游标不能再引用 */
     return inode->dir_cnt;
 }
 /**
@@ -190,8 +188,11 @@ struct sfs_inode* sfs_alloc_inode(struct sfs_dentry * dentry) {
     inode->dir_cnt = 0;
     inode->dentrys = NULL;
     
-    if (SFS_IS_REG(inode)) {
-        inode->data = (uint8_t *)malloc(SFS_BLKS_SZ(SFS_DATA_PER_FILE));
+    inode->data          = NULL;
+    inode->data_resident = 0;
+    if (SFS_IS_REG(inode)) {                          /* 新文件内容全为0，无需从磁盘读入 */
+        inode->data = (uint8_t *)calloc(1, SFS_BLKS_SZ(SFS_DATA_PER_FILE));
+        inode->data_resident = (uint32_t)((1ULL << SFS_DATA_PER_FILE) - 1);
     }
 
     return inode;
@@ -243,11 +244,20 @@ int sfs_sync_inode(struct sfs_inode * inode) {
             offset += sizeof(struct sfs_dentry_d);
         }
     }
-    else if (SFS_IS_REG(inode)) { /* 如果当前inode是文件，那么数据是文件内容，直接写即可 */
-        if (sfs_driver_write(SFS_DATA_OFS(ino), inode->data, 
-                             SFS_BLKS_SZ(SFS_DATA_PER_FILE)) != SFS_ERROR_NONE) {
-            SFS_DBG("[%s] io error\n", __func__);
-            return -SFS_ERROR_IO;
+    else if (SFS_IS_REG(inode) && inode->data != NULL) { /* 如果当前inode是文件，只写回已读入内存的块 */
+        int blk = 0, run;
+        while (blk < SFS_DATA_PER_FILE) {
+            if (!SFS_BLK_RESIDENT(inode, blk)) {
+                blk++;
+                continue;
+            }
+            for (run = 1; blk + run < SFS_DATA_PER_FILE && SFS_BLK_RESIDENT(inode, blk + run); run++);
+            if (sfs_driver_write(SFS_DATA_OFS(ino) + SFS_BLKS_SZ(blk), inode->data + SFS_BLKS_SZ(blk), 
+                                 SFS_BLKS_SZ(run)) != SFS_ERROR_NONE) {
+                SFS_DBG("[%s] io error\n", __func__);
+                return -SFS_ERROR_IO;
+            }
+            blk += run;
         }
     }
     return SFS_ERROR_NONE;
@@ -370,7 +380,9 @@ struct sfs_inode* sfs_read_inode(struct sfs_dentry * dentry, int ino) {
     memcpy(inode->target_path, inode_d.target_path, SFS_MAX_FILE_NAME);
     inode->dentry = dentry;
     inode->dentrys = NULL;
-    /* 内存中的inode的数据或子目录项部分也需要读出 */
+    inode->data = NULL;
+    inode->data_resident = 0;
+    /* 目录项需要读出，普通文件的数据在首次访问时由sfs_load_data按块读入 */
     if (SFS_IS_DIR(inode)) {
         dir_cnt = inode_d.dir_cnt;
         for (i = 0; i < dir_cnt; i++)
@@ -387,15 +399,55 @@ struct sfs_inode* sfs_read_inode(struct sfs_dentry * dentry, int ino) {
             sfs_alloc_dentry(inode, sub_dentry);
         }
     }
-    else if (SFS_IS_REG(inode)) {
+    return inode;
+}
+/**
+ * @brief 保证文件[offset, offset + size)范围内的数据块已读入inode->data
+ * 
+ * 每块是否已读入由data_resident记录，只读入缺失的块；被整块覆盖写的块无需读盘
+ * 
+ * @param inode 普通文件的索引结点
+ * @param offset 
+ * @param size 
+ * @param is_overwrite 调用者是否会覆盖整个范围(写操作)
+ * @return int 
+ */
+int sfs_load_data(struct sfs_inode * inode, int offset, int size, boolean is_overwrite) {
+    int blk, run;
+    int end = offset + size;
+
+    if (end > SFS_BLKS_SZ(SFS_DATA_PER_FILE)) {
+        end = SFS_BLKS_SZ(SFS_DATA_PER_FILE);
+    }
+    if (offset >= end) {
+        return SFS_ERROR_NONE;
+    }
+    if (inode->data == NULL) {
         inode->data = (uint8_t *)malloc(SFS_BLKS_SZ(SFS_DATA_PER_FILE));
-        if (sfs_driver_read(SFS_DATA_OFS(ino), (uint8_t *)inode->data, 
-                            SFS_BLKS_SZ(SFS_DATA_PER_FILE)) != SFS_ERROR_NONE) {
+    }
+
+    blk = offset / SFS_IO_SZ();
+    while (blk < SFS_ROUND_UP(end, SFS_IO_SZ()) / SFS_IO_SZ()) {
+        if (SFS_BLK_RESIDENT(inode, blk)) {
+            blk++;
+            continue;
+        }
+        if (is_overwrite && offset <= SFS_BLKS_SZ(blk) && SFS_BLKS_SZ(blk + 1) <= end) {
+            inode->data_resident |= (0x1U << blk);
+            blk++;
+            continue;
+        }
+        for (run = 1; SFS_BLKS_SZ(blk + run) < end && !SFS_BLK_RESIDENT(inode, blk + run); run++);
+        if (sfs_driver_read(SFS_DATA_OFS(inode->ino) + SFS_BLKS_SZ(blk), inode->data + SFS_BLKS_SZ(blk), 
+                            SFS_BLKS_SZ(run)) != SFS_ERROR_NONE) {
             SFS_DBG("[%s] io error\n", __func__);
-            return NULL;                    
+            return -SFS_ERROR_IO;
+        }
+        for (; run > 0; run--, blk++) {
+            inode->data_resident |= (0x1U << blk);
         }
     }
-    return inode;
+    return SFS_ERROR_NONE;
 }
 /**
  * @brief 
@@ -419,25 +471,22 @@ struct sfs_dentry* sfs_get_dentry(struct sfs_inode * inode, int dir) {
 }
 /**
  * @brief 查找文件或目录
- * path: /qwe/ad  total_lvl = 2,
- *      1) find /'s inode       lvl = 1
+ * 用sfs_path_next在原路径上逐个取分量(指针, 长度)，单遍扫描、不分配内存，名字按长度精确匹配
+ * path: /qwe/ad
+ *      1) find /'s inode
  *      2) find qwe's dentry 
- *      3) find qwe's inode     lvl = 2
- *      4) find ad's dentry
- *
- * path: /qwe     total_lvl = 1,
- *      1) find /'s inode       lvl = 1
- *      2) find qwe's dentry
- *  
+ *      3) find qwe's inode
+ *      4) find ad's dentry     ad之后没有分量，is_find=TRUE
  * 
  * 如果能查找到，返回该目录项
  * 如果查找不到，返回的是上一个有效的路径
  * 
  * path: /a/b/c
- *      1) find /'s inode     lvl = 1
+ *      1) find /'s inode
  *      2) find a's dentry 
- *      3) find a's inode     lvl = 2
+ *      3) find a's inode
  *      4) find b's dentry    如果此时找不到了，is_find=FALSE且返回的是a的inode对应的dentry
+ * 路径中间的分量是普通文件时返回该文件，is_find=FALSE
  * 
  * @param path 
  * @return struct sfs_dentry* 
@@ -446,61 +495,54 @@ struct sfs_dentry* sfs_lookup(const char * path, boolean* is_find, boolean* is_r
     struct sfs_dentry* dentry_cursor = sfs_super.root_dentry;
     struct sfs_dentry* dentry_ret = NULL;
     struct sfs_inode*  inode; 
-    int   total_lvl = sfs_calc_lvl(path);
-    int   lvl = 0;
-    boolean is_hit;
-    char* fname = NULL;
-    char* path_cpy = (char*)malloc(sizeof(path));
+    const char* fname;
+    const char* next;
+    int         len, next_len;
+    *is_find = FALSE;
     *is_root = FALSE;
-    strcpy(path_cpy, path);
 
-    if (total_lvl == 0) {                           /* 根目录 */
+    fname = sfs_path_next(path, &len);
+    if (fname == NULL) {                            /* 根目录 */
         *is_find = TRUE;
         *is_root = TRUE;
         dentry_ret = sfs_super.root_dentry;
     }
-    fname = strtok(path_cpy, "/");       
     while (fname)
     {   
-        lvl++;
+        next = sfs_path_next(fname + len, &next_len);
         if (dentry_cursor->inode == NULL) {           /* Cache机制 */
-            sfs_read_inode(dentry_cursor, dentry_cursor->ino);
+            dentry_cursor->inode = sfs_read_inode(dentry_cursor, dentry_cursor->ino);
         }
 
         inode = dentry_cursor->inode;
 
-        if (SFS_IS_REG(inode) && lvl < total_lvl) {
+        if (SFS_IS_REG(inode)) {                    /* 还有分量，但当前不是目录 */
             SFS_DBG("[%s] not a dir\n", __func__);
             dentry_ret = inode->dentry;
             break;
         }
-        if (SFS_IS_DIR(inode)) {
-            dentry_cursor = inode->dentrys;
-            is_hit        = FALSE;
-
-            while (dentry_cursor)   /* 遍历子目录项 */
-            {
-                if (memcmp(dentry_cursor->fname, fname, strlen(fname)) == 0) {
-                    is_hit = TRUE;
-                    break;
-                }
-                dentry_cursor = dentry_cursor->brother;
-            }
-            
-            if (!is_hit) {
-                *is_find = FALSE;
-                SFS_DBG("[%s] not found %s\n", __func__, fname);
-                dentry_ret = inode->dentry;
+        dentry_cursor = inode->dentrys;
+        while (dentry_cursor)   /* 遍历子目录项，长度和内容都相同才算命中 */
+        {
+            if (len < SFS_MAX_FILE_NAME && dentry_cursor->fname[len] == '\0' &&
+                memcmp(dentry_cursor->fname, fname, len) == 0) {
                 break;
             }
+            dentry_cursor = dentry_cursor->brother;
+        }
 
-            if (is_hit && lvl == total_lvl) {
-                *is_find = TRUE;
-                dentry_ret = dentry_cursor;
-                break;
-            }
+        if (dentry_cursor == NULL) {
+            SFS_DBG("[%s] not found %.*s\n", __func__, len, fname);
+            dentry_ret = inode->dentry;
+            break;
+        }
+        if (next == NULL) {
+            *is_find = TRUE;
+            dentry_ret = dentry_cursor;
+            break;
         }
-        fname = strtok(NULL, "/"); 
+        fname = next;
+        len   = next_len;
     }
 
     if (dentry_ret->inode == NULL) {